@@ -1,3 +1,33 @@
+#ifndef GPIO_H
+#define GPIO_H
+
+#include <string>
+
 void initGPIO(int gpioNum, bool direction);
 char readGPIO(int gpioNum);
 void writeGPIO(int gpioNum, bool gpioStatus);
+
+/*
+  A sysfs GPIO kept open. The value is read with pread on the open fd,
+  so a read is one system call. With an edge set, the fd signals
+  POLLPRI when the pin changes, so poll or epoll can wait for it.
+  The root defaults to /sys/class/gpio; any directory laid out the same
+  way (export, gpioN/direction, gpioN/value) can stand in for it.
+*/
+class GPIO
+{
+public:
+	GPIO(int gpioNum, bool input, const std::string& root = "/sys/class/gpio");
+	~GPIO();
+	bool isOpen();
+	int fd();
+	char read();
+	bool setEdge(const std::string& edge);
+	bool waitForEdge(int timeoutMs);
+private:
+	int gpioNum;
+	std::string dir;
+	int valueFd;
+};
+
+#endif
@@ -40,6 +40,8 @@ private:
 	float integratedError;
 	float windupGuard;
 	int pwmOut;
+	// a fixed time step, in the units of updatePID, or 0 to measure it
+	float sampleTime;
 
 public:
 	PID();
@@ -50,6 +52,7 @@ public:
 	void setI(float I);
 	void setP(float P);
 	void setWindupGuard(float windupGuard);
+	void setSampleTime(float seconds);
 	int getPwmOut();
 	void setPwmOut(int pwmOut);
 };
@@ -8,11 +8,10 @@
 #include "./findPose.h"
 #include "./SquarePattern.h"
 #include <map>
+#include <string>
 
-#define SquareSideLength 2.9
-#define GapLength 0.75
+// the tag dimensions are read at startup (see config.h)
 #define gridSize 3
-#define gridBorderOffset 2.2
 
 using namespace cv;
 
@@ -24,11 +23,44 @@ struct tagPose {
 const SquarePattern storedPatterns[] = {0x1a2, 0x154, 0x1a4};//{0xa3, 0xc3, 0x145};
 const SquarePattern INITIAL_PATTERN = storedPatterns[0];
 const int numPatterns = 3;
-std::map<SquarePattern, tagPose> patternPose;
 
-void addPattern(SquarePatternHandle& handle, SquarePattern pattern, tagPose pose) {
-  handle.add(pattern);
-  patternPose[pattern] = pose;
-}  
+/* write a set of tag poses to a tag map file */
+bool writeTagMap(const std::string& fileName, const std::map<SquarePattern, tagPose>& poses) {
+  FileStorage fs(fileName, FileStorage::WRITE);
+  if(!fs.isOpened()) {
+    std::cerr << "COULD NOT OPEN TAG MAP " << fileName << std::endl;
+    return false;
+  }
+
+  fs << "tags" << "[";
+  for(std::map<SquarePattern, tagPose>::const_iterator i = poses.begin(); i != poses.end(); ++i) {
+    fs << "{" << "pattern" << (int)i->first
+              << "r" << i->second.r_vec
+              << "t" << i->second.t << "}";
+  }
+  fs << "]";
+
+  return true;
+}
+
+/* read the tag poses of a tag map file */
+bool readTagMap(const std::string& fileName, std::map<SquarePattern, tagPose>& poses) {
+  FileStorage fs(fileName, FileStorage::READ);
+  if(!fs.isOpened()) {
+    std::cerr << "COULD NOT OPEN TAG MAP " << fileName << std::endl;
+    return false;
+  }
+
+  FileNode tags = fs["tags"];
+  for(FileNodeIterator i = tags.begin(); i != tags.end(); ++i) {
+    tagPose pose;
+    (*i)["r"] >> pose.r_vec;
+    (*i)["t"] >> pose.t;
+    poses[(SquarePattern)(int)(*i)["pattern"]] = pose;
+  }
+
+  return true;
+}
+
   
 #endif
@@ -0,0 +1,107 @@
+#ifndef BATCH_DETECTOR
+#define BATCH_DETECTOR
+
+/******************************************
+ * batchDetector.h
+ *
+ * This file runs the tag detector over every
+ * frame of a recorded frame file, spreading
+ * the frames across all of the cores.
+ ******************************************/
+
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <atomic>
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "frameFile.h"
+#include "tagDetector.h"
+
+using namespace cv;
+
+// a single tag seen in a single frame
+struct TagObservation {
+  int frame;
+  SquarePattern pattern;
+  Point2f corner[4];
+  Point2f imageCorner[4];
+  Point3f object[4];
+  // transformation from the camera to the tag
+  Mat rp;
+  Mat tp;
+};
+
+/* detect the tags in every stride-th frame and return them grouped
+ * by frame. Frames are handed out to the worker threads one at a time
+ * so a slow frame never stalls the others; the result is in frame
+ * order regardless. refineCorners moves each corner to sub-pixel
+ * accuracy in the frame first.
+ */
+void detectFrames(FrameFileReader& frames, TagDetector& detector,
+                  vector< vector<TagObservation> >& observations,
+                  int stride = 1, int numThreads = 0, bool refineCorners = false) {
+  if(numThreads <= 0) numThreads = std::thread::hardware_concurrency();
+  if(numThreads <= 0) numThreads = 1;
+  if(stride < 1) stride = 1;
+
+  int numFrames = (frames.size() + stride - 1) / stride;
+  observations.clear();
+  observations.resize(numFrames);
+
+  std::atomic<int> next(0);
+  std::atomic<int> done(0);
+
+  auto worker = [&]() {
+    Mat img;
+    vector<CandidateTag*> candidateTags;
+    for(int k = next++; k < numFrames; k = next++) {
+      int f = k*stride;
+      detector.undistort(frames.frame(f), img);
+
+      candidateTags.clear();
+      detector.findCandidateTags(candidateTags, img);
+
+      for(int i = 0; i < candidateTags.size(); ++i) {
+        TagObservation obs;
+        obs.frame = f;
+        obs.pattern = candidateTags[i]->pattern;
+        for(int z = 0; z < 4; z++) {
+          obs.corner[z] = candidateTags[i]->corner[z];
+          obs.imageCorner[z] = candidateTags[i]->imageCorner[z];
+          obs.object[z] = candidateTags[i]->object[z];
+        }
+
+        if(refineCorners) {
+          vector<Point2f> refined(obs.imageCorner, obs.imageCorner + 4);
+          cornerSubPix(img, refined, Size(5,5), Size(-1,-1),
+                       TermCriteria(CV_TERMCRIT_EPS + CV_TERMCRIT_ITER, 30, 0.01));
+          for(int z = 0; z < 4; z++) {
+            obs.imageCorner[z] = refined[z];
+            obs.corner[z] = detector.undistortPoint(refined[z]);
+          }
+        }
+
+        obs.rp = candidateTags[i]->rp;
+        obs.tp = candidateTags[i]->tp;
+        observations[k].push_back(obs);
+        delete candidateTags[i];
+      }
+
+      int count = ++done;
+      if(count % 1000 == 0)
+        std::cerr << "detected " << count << "/" << numFrames << " frames" << std::endl;
+    }
+  };
+
+  vector<std::thread> workers;
+  for(int i = 0; i < numThreads; i++) {
+    workers.push_back(std::thread(worker));
+  }
+  for(int i = 0; i < numThreads; i++) {
+    workers[i].join();
+  }
+}
+
+#endif
@@ -0,0 +1,423 @@
+#ifndef BUNDLE_ADJUSTER
+#define BUNDLE_ADJUSTER
+
+/******************************************
+ * bundleAdjuster.h
+ *
+ * This file builds a tag map from the tags
+ * seen over a whole recording.
+ *
+ * The tags are first chained together the
+ * way registerUnknownTags does online, then
+ * every tag pose and every camera pose is
+ * refined together by minimizing the
+ * reprojection error of all tag corners
+ * (Levenberg-Marquardt on the normal
+ * equations, with the camera poses
+ * eliminated through the Schur complement
+ * so the solve only grows with the number
+ * of tags).
+ *
+ * Camera poses transform from the world to
+ * the camera, tag poses from the tag to the
+ * world. The initial tag fixes the world.
+ ******************************************/
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <cmath>
+#include <algorithm>
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/calib3d/calib3d.hpp"
+
+#include "StoredPatterns.h"
+#include "batchDetector.h"
+
+using namespace cv;
+
+typedef Matx<double, 8, 6> Matx86d;
+
+class BundleAdjuster {
+public:
+  BundleAdjuster(const Mat& cameraMatrix, double huberThreshold = 2.0);
+
+  void addFrame(const vector<TagObservation>&);
+  int initialize(SquarePattern anchor = INITIAL_PATTERN);
+  double optimize(int maxIterations = 50);
+  void getTagPoses(std::map<SquarePattern, tagPose>&);
+
+  int numFrames();
+  int numTags();
+
+private:
+  struct RigidPose {
+    Vec3d r;
+    Vec3d t;
+  };
+
+  struct FrameBlock {
+    Matx66d Uinv;
+    Vec6d g;
+    vector<int> tag;
+    vector<Matx66d> W;
+  };
+
+  static Matx33d rotationMatrix(const Vec3d&);
+  void project(const TagObservation&, const RigidPose&, const RigidPose&, double*);
+  void linearize(const TagObservation&, const RigidPose&, const RigidPose&,
+                 Vec<double, 8>&, Matx86d&, Matx86d&);
+  double cost(const vector<RigidPose>&, const vector<RigidPose>&);
+  double weight(double);
+
+  double fx, fy, cx, cy;
+  double huber;
+  SquarePattern anchor;
+
+  vector< vector<TagObservation> > frames;
+  vector<RigidPose> cameras;
+
+  // tag 0 is always the anchor and is never moved
+  std::map<SquarePattern, int> tagIndex;
+  vector<SquarePattern> tagPatterns;
+  vector<RigidPose> tags;
+};
+
+BundleAdjuster::BundleAdjuster(const Mat& cameraMatrix, double huberThreshold) {
+  Mat K;
+  cameraMatrix.convertTo(K, CV_64F);
+  fx = K.at<double>(0,0);
+  fy = K.at<double>(1,1);
+  cx = K.at<double>(0,2);
+  cy = K.at<double>(1,2);
+  huber = huberThreshold;
+  anchor = NULL_PATTERN;
+}
+
+/* frames that see fewer than two tags say nothing about
+ * where the tags are relative to each other, so they are dropped.
+ */
+void BundleAdjuster::addFrame(const vector<TagObservation>& observations) {
+  if(observations.size() >= 2) frames.push_back(observations);
+}
+
+int BundleAdjuster::numFrames() {
+  return frames.size();
+}
+
+int BundleAdjuster::numTags() {
+  return tags.size();
+}
+
+/* chain every tag to the anchor tag through the frames in which
+ * they are seen together, repeating until no more tags are found
+ * so the order of the recording does not matter.
+ */
+int BundleAdjuster::initialize(SquarePattern anchor) {
+  this->anchor = anchor;
+
+  std::map<SquarePattern, tagPose> known;
+  known[anchor].r_vec = (Mat_<double>(3,1) << 0.,0.,0.);
+  known[anchor].t = (Mat_<double>(3,1) << 0.,0.,0.);
+
+  bool added = true;
+  while(added) {
+    added = false;
+    for(int f = 0; f < frames.size(); f++) {
+      vector<TagObservation>& obs = frames[f];
+
+      int k = 0;
+      while(k < obs.size() && known.find(obs[k].pattern) == known.end()) k++;
+      if(k == obs.size()) continue;
+
+      // camera to world through the known tag
+      Mat r0, t0, R;
+      composeRT(obs[k].rp, obs[k].tp, known[obs[k].pattern].r_vec, known[obs[k].pattern].t, r0, t0);
+
+      for(int i = 0; i < obs.size(); i++) {
+        if(known.find(obs[i].pattern) != known.end()) continue;
+
+        tagPose newPose;
+        Rodrigues(-obs[i].rp, R);
+        composeRT(-obs[i].rp, -R*obs[i].tp, r0, t0, newPose.r_vec, newPose.t);
+        known[obs[i].pattern] = newPose;
+        added = true;
+      }
+    }
+  }
+
+  // tags never seen with a located tag cannot be placed
+  vector< vector<TagObservation> > located;
+  for(int f = 0; f < frames.size(); f++) {
+    vector<TagObservation> obs;
+    for(int i = 0; i < frames[f].size(); i++) {
+      if(known.find(frames[f][i].pattern) != known.end()) obs.push_back(frames[f][i]);
+    }
+    if(obs.size() >= 2) located.push_back(obs);
+  }
+  frames.swap(located);
+
+  tagIndex.clear();
+  tagPatterns.clear();
+  tags.clear();
+
+  tagIndex[anchor] = 0;
+  tagPatterns.push_back(anchor);
+  for(std::map<SquarePattern, tagPose>::iterator i = known.begin(); i != known.end(); ++i) {
+    if(i->first == anchor) continue;
+    tagIndex[i->first] = tags.size() + 1;
+    tagPatterns.push_back(i->first);
+  }
+
+  tags.resize(tagPatterns.size());
+  for(int i = 0; i < tagPatterns.size(); i++) {
+    tagPose& p = known[tagPatterns[i]];
+    tags[i].r = Vec3d(p.r_vec.at<double>(0), p.r_vec.at<double>(1), p.r_vec.at<double>(2));
+    tags[i].t = Vec3d(p.t.at<double>(0), p.t.at<double>(1), p.t.at<double>(2));
+  }
+
+  // each frame takes its starting camera pose from its first tag
+  cameras.resize(frames.size());
+  for(int f = 0; f < frames.size(); f++) {
+    TagObservation& o = frames[f][0];
+    tagPose& p = known[o.pattern];
+
+    Mat r0, t0, R;
+    composeRT(o.rp, o.tp, p.r_vec, p.t, r0, t0);
+    Rodrigues(r0, R);
+    R = R.t();
+    t0 = -R*t0;
+    Rodrigues(R, r0);
+
+    cameras[f].r = Vec3d(r0.at<double>(0), r0.at<double>(1), r0.at<double>(2));
+    cameras[f].t = Vec3d(t0.at<double>(0), t0.at<double>(1), t0.at<double>(2));
+  }
+
+  return tags.size();
+}
+
+/* rotation vector to rotation matrix */
+Matx33d BundleAdjuster::rotationMatrix(const Vec3d& r) {
+  double theta = norm(r);
+  if(theta < 1e-12) {
+    return Matx33d(   1., -r[2],  r[1],
+                    r[2],    1., -r[0],
+                   -r[1],  r[0],    1.);
+  }
+
+  Vec3d k = r*(1./theta);
+  Matx33d K(    0., -k[2],  k[1],
+              k[2],    0., -k[0],
+             -k[1],  k[0],    0.);
+  return Matx33d::eye() + sin(theta)*K + (1. - cos(theta))*(K*K);
+}
+
+/* the image position of the four corners of a tag, as u0 v0 u1 v1 ... */
+void BundleAdjuster::project(const TagObservation& o, const RigidPose& camera,
+                             const RigidPose& tag, double* uv) {
+  Matx33d Rc = rotationMatrix(camera.r);
+  Matx33d Rt = rotationMatrix(tag.r);
+
+  for(int z = 0; z < 4; z++) {
+    Vec3d X(o.object[z].x, o.object[z].y, o.object[z].z);
+    Vec3d Xc = Rc*(Rt*X + tag.t) + camera.t;
+    uv[2*z]   = fx*Xc[0]/Xc[2] + cx;
+    uv[2*z+1] = fy*Xc[1]/Xc[2] + cy;
+  }
+}
+
+/* residual and forward-difference jacobians of one observation */
+void BundleAdjuster::linearize(const TagObservation& o, const RigidPose& camera, const RigidPose& tag,
+                               Vec<double, 8>& r, Matx86d& Jc, Matx86d& Jt) {
+  const double h = 1e-6;
+  double uv[8], duv[8];
+
+  project(o, camera, tag, uv);
+  for(int z = 0; z < 4; z++) {
+    r[2*z]   = uv[2*z]   - o.corner[z].x;
+    r[2*z+1] = uv[2*z+1] - o.corner[z].y;
+  }
+
+  for(int k = 0; k < 6; k++) {
+    RigidPose c = camera;
+    if(k < 3) c.r[k] += h;
+    else      c.t[k-3] += h;
+    project(o, c, tag, duv);
+    for(int i = 0; i < 8; i++) Jc(i, k) = (duv[i] - uv[i])/h;
+
+    RigidPose t = tag;
+    if(k < 3) t.r[k] += h;
+    else      t.t[k-3] += h;
+    project(o, camera, t, duv);
+    for(int i = 0; i < 8; i++) Jt(i, k) = (duv[i] - uv[i])/h;
+  }
+}
+
+/* huber weight of a corner with the given reprojection error */
+double BundleAdjuster::weight(double e) {
+  return (e <= huber)? 1. : huber/e;
+}
+
+/* robust cost of all observations with the given poses */
+double BundleAdjuster::cost(const vector<RigidPose>& cameras, const vector<RigidPose>& tags) {
+  double total = 0;
+  double uv[8];
+
+  for(int f = 0; f < frames.size(); f++) {
+    for(int i = 0; i < frames[f].size(); i++) {
+      TagObservation& o = frames[f][i];
+      project(o, cameras[f], tags[tagIndex[o.pattern]], uv);
+      for(int z = 0; z < 4; z++) {
+        double e = std::sqrt((uv[2*z] - o.corner[z].x)*(uv[2*z] - o.corner[z].x) +
+                             (uv[2*z+1] - o.corner[z].y)*(uv[2*z+1] - o.corner[z].y));
+        total += (e <= huber)? e*e : 2*huber*e - huber*huber;
+      }
+    }
+  }
+
+  return total;
+}
+
+static void addBlock(Mat& S, int i, int j, const Matx66d& block, double scale = 1.) {
+  for(int a = 0; a < 6; a++) {
+    double* row = S.ptr<double>(6*i + a) + 6*j;
+    for(int b = 0; b < 6; b++) row[b] += scale*block(a, b);
+  }
+}
+
+/* refine all poses, returning the final RMS reprojection error in pixels */
+double BundleAdjuster::optimize(int maxIterations) {
+  int numCorners = 0;
+  for(int f = 0; f < frames.size(); f++) numCorners += 4*frames[f].size();
+  if(numCorners == 0 || tags.size() < 2) return 0;
+
+  int T = tags.size() - 1;
+  double lambda = 1e-3;
+  double currentCost = cost(cameras, tags);
+
+  vector<FrameBlock> blocks(frames.size());
+
+  for(int iteration = 0; iteration < maxIterations; iteration++) {
+    Mat S = Mat::zeros(6*T, 6*T, CV_64F);
+    Mat rhs = Mat::zeros(6*T, 1, CV_64F);
+    vector<Matx66d> V(T, Matx66d::zeros());
+
+    for(int f = 0; f < frames.size(); f++) {
+      FrameBlock& block = blocks[f];
+      Matx66d U = Matx66d::zeros();
+      block.g = Vec6d::all(0);
+      block.tag.clear();
+      block.W.clear();
+
+      for(int i = 0; i < frames[f].size(); i++) {
+        TagObservation& o = frames[f][i];
+        int ti = tagIndex[o.pattern];
+
+        Vec<double, 8> r;
+        Matx86d Jc, Jt;
+        linearize(o, cameras[f], tags[ti], r, Jc, Jt);
+
+        // reweight each corner so outliers pull with constant force
+        for(int c = 0; c < 8; c += 2) {
+          double sw = std::sqrt(weight(std::sqrt(r[c]*r[c] + r[c+1]*r[c+1])));
+          for(int k = 0; k < 6; k++) {
+            Jc(c, k) *= sw; Jc(c+1, k) *= sw;
+            Jt(c, k) *= sw; Jt(c+1, k) *= sw;
+          }
+          r[c] *= sw; r[c+1] *= sw;
+        }
+
+        U += Jc.t()*Jc;
+        block.g -= Jc.t()*r;
+
+        if(ti == 0) continue;
+
+        Vec6d gt = Jt.t()*r;
+        V[ti-1] += Jt.t()*Jt;
+        for(int k = 0; k < 6; k++) rhs.at<double>(6*(ti-1) + k) -= gt[k];
+
+        block.tag.push_back(ti-1);
+        block.W.push_back(Jc.t()*Jt);
+      }
+
+      for(int k = 0; k < 6; k++) U(k, k) += lambda*U(k, k) + 1e-9;
+      block.Uinv = U.inv(DECOMP_CHOLESKY);
+
+      // eliminate the camera pose of this frame
+      for(int a = 0; a < block.tag.size(); a++) {
+        Matx66d WtUinv = block.W[a].t()*block.Uinv;
+        Vec6d ga = WtUinv*block.g;
+        for(int k = 0; k < 6; k++) rhs.at<double>(6*block.tag[a] + k) -= ga[k];
+        for(int b = 0; b < block.tag.size(); b++) {
+          addBlock(S, block.tag[a], block.tag[b], WtUinv*block.W[b], -1.);
+        }
+      }
+    }
+
+    for(int i = 0; i < T; i++) {
+      for(int k = 0; k < 6; k++) V[i](k, k) += lambda*V[i](k, k) + 1e-9;
+      addBlock(S, i, i, V[i]);
+    }
+
+    Mat delta;
+    if(!solve(S, rhs, delta, DECOMP_CHOLESKY)) {
+      solve(S, rhs, delta, DECOMP_SVD);
+    }
+
+    // back-substitute for the camera poses
+    vector<RigidPose> newCameras(cameras), newTags(tags);
+    for(int i = 0; i < T; i++) {
+      for(int k = 0; k < 3; k++) {
+        newTags[i+1].r[k] += delta.at<double>(6*i + k);
+        newTags[i+1].t[k] += delta.at<double>(6*i + 3 + k);
+      }
+    }
+
+    for(int f = 0; f < frames.size(); f++) {
+      FrameBlock& block = blocks[f];
+      Vec6d g = block.g;
+      for(int a = 0; a < block.tag.size(); a++) {
+        Vec6d dt;
+        for(int k = 0; k < 6; k++) dt[k] = delta.at<double>(6*block.tag[a] + k);
+        g -= block.W[a]*dt;
+      }
+      Vec6d dc = block.Uinv*g;
+      for(int k = 0; k < 3; k++) {
+        newCameras[f].r[k] += dc[k];
+        newCameras[f].t[k] += dc[k+3];
+      }
+    }
+
+    double newCost = cost(newCameras, newTags);
+    if(newCost < currentCost) {
+      double improvement = (currentCost - newCost)/currentCost;
+      cameras.swap(newCameras);
+      tags.swap(newTags);
+      currentCost = newCost;
+      lambda = std::max(lambda/10., 1e-9);
+
+      std::cerr << "iteration " << iteration << ": RMS " << std::sqrt(currentCost/numCorners)
+                << " px" << std::endl;
+      if(improvement < 1e-6) break;
+    }
+    else {
+      lambda *= 10.;
+      if(lambda > 1e9) break;
+    }
+  }
+
+  return std::sqrt(currentCost/numCorners);
+}
+
+/* the refined pose of every tag, from the tag to the world */
+void BundleAdjuster::getTagPoses(std::map<SquarePattern, tagPose>& poses) {
+  for(int i = 0; i < tags.size(); i++) {
+    tagPose p;
+    p.r_vec = (Mat_<double>(3,1) << tags[i].r[0], tags[i].r[1], tags[i].r[2]);
+    p.t = (Mat_<double>(3,1) << tags[i].t[0], tags[i].t[1], tags[i].t[2]);
+    poses[tagPatterns[i]] = p;
+  }
+}
+
+#endif
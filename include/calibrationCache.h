@@ -0,0 +1,208 @@
+#ifndef CALIBRATION_CACHE
+#define CALIBRATION_CACHE
+
+/******************************************
+ * calibrationCache.h
+ *
+ * This file keeps the tables derived from
+ * the calibration (undistortion maps, test
+ * points, pattern lookup) on disk between
+ * runs, so startup maps them in instead of
+ * recomputing them.
+ *
+ * A cache file is named after a hash of
+ * everything the tables were computed from;
+ * a changed calibration simply misses and
+ * writes a new file.
+ ******************************************/
+
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "opencv2/core/core.hpp"
+
+const char CALIBRATION_CACHE_MAGIC[8] = {'Q','F','C','A','C','H','E','1'};
+const int cacheAlignment = 64;
+
+struct CacheHeader {
+  char magic[8];
+  uint64_t hash;
+  uint32_t numTables;
+  uint32_t reserved;
+};
+
+struct CacheTable {
+  int32_t rows;
+  int32_t cols;
+  int32_t type;
+  int32_t reserved;
+  uint64_t offset;
+};
+
+/* FNV-1a, used to key the cache on its inputs */
+class CacheKey {
+public:
+  CacheKey() : hash(14695981039346656037ULL) {}
+
+  void add(const void* data, size_t length) {
+    const uint8_t* p = (const uint8_t*)data;
+    for(size_t i = 0; i < length; i++) {
+      hash ^= p[i];
+      hash *= 1099511628211ULL;
+    }
+  }
+
+  void add(double value) { add(&value, sizeof(value)); }
+
+  void add(const cv::Mat& m) {
+    cv::Mat d;
+    m.convertTo(d, CV_64F);
+    d = d.reshape(1, 1);
+    add(d.data, d.total()*d.elemSize());
+  }
+
+  uint64_t value() { return hash; }
+
+private:
+  uint64_t hash;
+};
+
+class CalibrationCache {
+public:
+  CalibrationCache();
+  ~CalibrationCache();
+
+  static std::string fileName(const std::string& dir, uint64_t hash);
+  bool map(const std::string& fileName, uint64_t hash, std::vector<cv::Mat>& tables);
+  static bool write(const std::string& fileName, uint64_t hash, const std::vector<cv::Mat>& tables);
+
+private:
+  void* addr;
+  size_t length;
+};
+
+CalibrationCache::CalibrationCache() {
+  addr = NULL;
+  length = 0;
+}
+
+/* the mapped tables are only valid while the cache is alive */
+CalibrationCache::~CalibrationCache() {
+  if(addr) munmap(addr, length);
+}
+
+std::string CalibrationCache::fileName(const std::string& dir, uint64_t hash) {
+  std::stringstream name;
+  name << dir << "/calibration-" << std::hex << std::setw(16) << std::setfill('0') << hash << ".cache";
+  return name.str();
+}
+
+/* map a cache file and point the tables at it; fails on any mismatch */
+bool CalibrationCache::map(const std::string& fileName, uint64_t hash, std::vector<cv::Mat>& tables) {
+  int fd = open(fileName.c_str(), O_RDONLY);
+  if(fd < 0) return false;
+
+  struct stat st;
+  if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(CacheHeader)) {
+    close(fd);
+    return false;
+  }
+
+  void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+  close(fd);
+  if(p == MAP_FAILED) return false;
+
+  const CacheHeader* header = (const CacheHeader*)p;
+  const CacheTable* table = (const CacheTable*)(header + 1);
+  size_t size = st.st_size;
+
+  bool valid = memcmp(header->magic, CALIBRATION_CACHE_MAGIC, sizeof(header->magic)) == 0 &&
+               header->hash == hash &&
+               sizeof(CacheHeader) + header->numTables*sizeof(CacheTable) <= size;
+
+  std::vector<cv::Mat> mapped;
+  for(uint32_t i = 0; valid && i < header->numTables; i++) {
+    size_t bytes = (size_t)table[i].rows * table[i].cols * CV_ELEM_SIZE(table[i].type);
+    if(table[i].offset + bytes > size) {
+      valid = false;
+      break;
+    }
+    if(bytes == 0) mapped.push_back(cv::Mat());
+    else mapped.push_back(cv::Mat(table[i].rows, table[i].cols, table[i].type, (uint8_t*)p + table[i].offset));
+  }
+
+  if(!valid) {
+    munmap(p, st.st_size);
+    return false;
+  }
+
+  if(addr) munmap(addr, length);
+  addr = p;
+  length = st.st_size;
+  tables.swap(mapped);
+  return true;
+}
+
+/* write the tables to a cache file; written to a temporary
+ * file first so a reader never maps a partial cache.
+ */
+bool CalibrationCache::write(const std::string& fileName, uint64_t hash, const std::vector<cv::Mat>& tables) {
+  std::string tempName = fileName + ".tmp";
+  int fd = open(tempName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0) {
+    std::cerr << "COULD NOT WRITE CALIBRATION CACHE " << fileName << std::endl;
+    return false;
+  }
+
+  CacheHeader header;
+  memcpy(header.magic, CALIBRATION_CACHE_MAGIC, sizeof(header.magic));
+  header.hash = hash;
+  header.numTables = tables.size();
+  header.reserved = 0;
+
+  std::vector<CacheTable> descriptors(tables.size());
+  uint64_t offset = sizeof(CacheHeader) + tables.size()*sizeof(CacheTable);
+  for(size_t i = 0; i < tables.size(); i++) {
+    offset = (offset + cacheAlignment - 1) / cacheAlignment * cacheAlignment;
+    descriptors[i].rows = tables[i].rows;
+    descriptors[i].cols = tables[i].cols;
+    descriptors[i].type = tables[i].type();
+    descriptors[i].reserved = 0;
+    descriptors[i].offset = offset;
+    offset += tables[i].total()*tables[i].elemSize();
+  }
+
+  bool ok = ::write(fd, &header, sizeof(header)) == sizeof(header);
+  if(!descriptors.empty())
+    ok = ok && ::write(fd, &descriptors[0], descriptors.size()*sizeof(CacheTable)) ==
+               (ssize_t)(descriptors.size()*sizeof(CacheTable));
+
+  for(size_t i = 0; ok && i < tables.size(); i++) {
+    cv::Mat t = tables[i].isContinuous()? tables[i] : tables[i].clone();
+    size_t bytes = t.total()*t.elemSize();
+    ok = pwrite(fd, t.data, bytes, descriptors[i].offset) == (ssize_t)bytes;
+  }
+
+  close(fd);
+  if(!ok || rename(tempName.c_str(), fileName.c_str()) != 0) {
+    std::cerr << "COULD NOT WRITE CALIBRATION CACHE " << fileName << std::endl;
+    unlink(tempName.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+#endif
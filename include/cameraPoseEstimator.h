@@ -9,12 +9,19 @@
  *
  * This file encapsulates the vision system
  * in a class with a straightforward interface.
+ *
+ * There is one estimator per camera, each run
+ * on its own thread; they share the map of
+ * known tags (see cameraRig.h).
  ******************************************/
 
 // selection of camera:
 // Laptop camera is for debugging,
-// define USE_ECON_CAMERA for code on Gumstix.
+// define USE_ECON_CAMERA for code on Gumstix,
+// or USE_FRAME_BUS instead to read the frames
+// capture_daemon publishes from the econ camera.
 //#define USE_ECON_CAMERA
+//#define USE_FRAME_BUS
 #define USE_LAPTOP_CAMERA
 
 #include <iostream>
@@ -29,6 +36,7 @@
 #include <atomic>
 #include <thread>
 #include <chrono>
+#include <unistd.h>
 
 #include "opencv2/imgproc/imgproc.hpp"
 #include "opencv2/highgui/highgui.hpp"
@@ -37,76 +45,111 @@
 #include "findPose.h"
 #include "SquarePattern.h"
 #include "StoredPatterns.h"
+#include "config.h"
+#include "tagDetector.h"
+#include "tagTracker.h"
+#include "tagMap.h"
+#include "frameFile.h"
+#include "debugOutput.h"
 #include "econ.h"
+#include "frameBus.h"
 
 using namespace cv;
 
-struct CandidateTag {
-  Point2f corner[4];
-  SquarePattern pattern;
-  Mat r;
-  Mat t;
-  Mat rp;
-  Mat tp;
-};
-
 class CameraPoseEstimator {
 public:
-  CameraPoseEstimator();
+  CameraPoseEstimator(const FlyConfig&, const CameraConfig&, TagMap*);
 //  ~CameraPoseEstimator();
 
   void continuousRead();
   bool dataAvailable();
   void getPose(Pose3D&);
+  bool record(const std::string&);
+  void setDebugOutput(DebugOutput*);
+  void setNotifyFd(int);
 /*  int getRawPose(Pose3D&);
   int getTagPose(Pose3D&);
 */
 
 private:
   void getImage(Mat&);
-  void findCandidateTags(vector<CandidateTag*>&, Mat&);
-  void filterTags(vector<CandidateTag*>&, vector<CandidateTag*>&, vector<CandidateTag*>&);
+  void setMode(int);
+  void selectMode(const Mat&);
+  void predictTags(vector<ExpectedTag>&);
+  void filterTags(vector<CandidateTag*>&, vector<CandidateTag*>&, vector<CandidateTag*>&,
+                  const vector<ExpectedTag>& = vector<ExpectedTag>());
   void registerUnknownTags(vector<CandidateTag*>&, Mat&, Mat&);
 
   std::atomic_bool hasNewData;
 
-  static const int NUMROWS = 480;
-  static const int NUMCOLS = 640;
+  int NUMROWS;
+  int NUMCOLS;
 
   #ifdef USE_ECON_CAMERA
-    static const int cameraId = 2;
+    static const int defaultCameraId = 2;
   #else
-    static const int cameraId = 0;
+    static const int defaultCameraId = 0;
   #endif
+  int cameraId;
 
-  static const int polygonCloseResolution = 1000;//15;
-  float innerSquareLength;
-
-  #ifdef USE_ECON_CAMERA
+  #if defined(USE_FRAME_BUS)
+    FrameBusReader* capture;
+  #elif defined(USE_ECON_CAMERA)
     econ* capture;
   #else
     VideoCapture capture;
   #endif
 
-  SquarePatternHandle* squareHandle;
-  SquarePatternHandle* candidateHandle;
-
-  Mat cameraMatrix, distCoeffs, distmap1, distmap2;
-
-  vector<Point3f> testPointGrid;
-  vector<Point3f> testOuterSquare;
-  vector<SquarePattern> foundPatterns;
-//  std::map<SquarePattern, tagPose> foundTags;
+  TagMap* tagMap;
+  TagDetector* detector;
+  TagTracker* tracker;
+  FrameFileWriter* recorder;
+  DebugOutput* debug;
+  // an eventfd signalled with every new pose, -1 for none
+  int notifyFd;
+
+  // one detector and tracker per camera mode, built up front so
+  // switching modes in flight costs no more than the ioctls
+  CameraConfig camera;
+  TagGeometry tagGeometry;
+  TrackerConfig trackerConfig;
+  std::string cacheDir;
+  vector<TagDetector*> modeDetectors;
+  vector<TagTracker*> modeTrackers;
+  int currentMode;
+  float speed;
+  Mat lastPosition;
+  std::chrono::steady_clock::time_point lastPoseTime;
+
+  // the last pose, from the world to the camera as a rotation
+  // vector and a translation, predicts which tags of the map
+  // the next detection will see
+  VisibilityConfig visibility;
+  bool havePrediction;
+  Mat predictR;
+  Mat predictT;
+  Mat predictPosition;
+  int detections;
+
+  // rotation and translation from the body to the camera
+  Mat bodyToCameraR;
+  Mat bodyToCameraT;
 
 //  Pose3D pose;
   vector<Pose3D> poseList;
   std::mutex listAccess;
 };
 
-CameraPoseEstimator::CameraPoseEstimator() {
+CameraPoseEstimator::CameraPoseEstimator(const FlyConfig& config, const CameraConfig& camera, TagMap* tagMap) {
+  NUMROWS = camera.height;
+  NUMCOLS = camera.width;
+  cameraId = (camera.device >= 0)? camera.device : defaultCameraId;
 
   // set up camera and tag handler
-  #ifdef USE_ECON_CAMERA
+  #if defined(USE_FRAME_BUS)
+    // the daemon owns the camera, so the mode is its choice
+    capture = new FrameBusReader(frameBusName(cameraId));
+  #elif defined(USE_ECON_CAMERA)
     capture = new econ(cameraId, NUMCOLS, NUMROWS);
   #else
     capture.open(cameraId);
@@ -117,74 +160,139 @@ CameraPoseEstimator::CameraPoseEstimator() {
     capture.read(src);
   #endif
 
-  squareHandle = new SquarePatternHandle(3);
-  candidateHandle = new SquarePatternHandle(3);
+  this->tagMap = tagMap;
+  visibility = config.visibility;
+  havePrediction = false;
+  detections = 0;
+  recorder = NULL;
+  debug = NULL;
+  notifyFd = -1;
 
   hasNewData = false;
 
-  // add the initial tag to the tag handler
-  tagPose initialPose;
-  initialPose.r_vec = (Mat_<double>(3,1) << 0.,0.,0.);  
-  initialPose.t = (Mat_<double>(3,1) << 0.,0.,0.);
-  addPattern(*squareHandle, INITIAL_PATTERN, initialPose);
-  
-  // add the candidate patterns to the candidate handler
-  for(int k = 0 ; k < numPatterns; k++) {
-    candidateHandle->add(storedPatterns[k]);
+  Rodrigues(camera.bodyRotation, bodyToCameraR);
+  bodyToCameraR = bodyToCameraR.t();
+  bodyToCameraT = -bodyToCameraR*camera.bodyTranslation;
+
+  this->camera = camera;
+  tagGeometry = config.tag;
+  trackerConfig = config.tracker;
+  cacheDir = config.cacheDir;
+  currentMode = 0;
+  speed = 0;
+
+  #ifdef USE_ECON_CAMERA
+    for(int i = 0; i < camera.modes.size(); i++) {
+      const CaptureMode& mode = camera.modes[i];
+      modeDetectors.push_back(new TagDetector(rescaleCamera(camera, mode.crop, mode.width, mode.height),
+                                              config.tag, config.cacheDir));
+      modeTrackers.push_back(new TagTracker(modeDetectors.back(), config.tracker));
+    }
+  #endif
+
+  if(modeDetectors.empty()) {
+    modeDetectors.push_back(new TagDetector(camera, config.tag, config.cacheDir));
+    modeTrackers.push_back(new TagTracker(modeDetectors.back(), config.tracker));
   }
 
-  // set up the camera matrix and distortion matrix, found through camera calibration.
-  cameraMatrix = (Mat_<float>(3,3) << 5.7951952713850142e+02, 0., 3.1950000e+02, 0., 5.7951952713850142e+02, 2.395000e+02, 0., 0., 1.);
-  distCoeffs = (Mat_<float>(5,1) << 3.3071823987974308e-01, -2.5506436646233288e+00, 0., 0., 5.0980401718181261e+00);
-
-  // set up the test points for the pattern grid
-  Point3f cur;  
-  for(int i = 0; i < gridSize; i++) {
-    for(int j = 0; j < gridSize; j++) {
-      cur.x = gridBorderOffset + ((float)i)*GapLength + ((float)i + 0.5)*SquareSideLength;
-      cur.y = gridBorderOffset + ((float)j)*GapLength + ((float)j + 0.5)*SquareSideLength;
-      cur.z = 0;
-      testPointGrid.push_back(cur);
+  detector = modeDetectors[0];
+  tracker = modeTrackers[0];
+  #ifdef USE_ECON_CAMERA
+    if(!camera.modes.empty()) setMode(0);
+  #endif
+}
+
+/* record every grayscale frame, before undistortion, to a frame file.
+ * The camera thread writes through the recorder without a lock, so
+ * one set up already is never replaced.
+ */
+bool CameraPoseEstimator::record(const std::string& fileName) {
+  if(recorder) {
+    std::cerr << "ALREADY RECORDING, NOT RECORDING TO " << fileName << std::endl;
+    return false;
+  }
+
+  FrameFileWriter* writer = new FrameFileWriter(fileName, NUMCOLS, NUMROWS, CV_8UC1);
+  if(!writer->isOpen()) {
+    delete writer;
+    return false;
+  }
+  recorder = writer;
+  return true;
+}
+
+/* draw every so many frames, with what was found in them, to a debug video */
+void CameraPoseEstimator::setDebugOutput(DebugOutput* debug) {
+  this->debug = debug;
+}
+
+/* wake whoever waits on an eventfd when a pose is ready */
+void CameraPoseEstimator::setNotifyFd(int fd) {
+  notifyFd = fd;
+}
+
+/* switch the camera to one of the configured modes */
+void CameraPoseEstimator::setMode(int i) {
+  #ifdef USE_ECON_CAMERA
+    const CaptureMode& mode = camera.modes[i];
+    struct v4l2_rect crop;
+    crop.left = mode.crop.x;
+    crop.top = mode.crop.y;
+    crop.width = mode.crop.width;
+    crop.height = mode.crop.height;
+    if(capture->setMode(crop, mode.width, mode.height) < 0) return;
+
+    // the driver may round the mode; the intrinsics must match what it chose
+    int width, height;
+    capture->getMode(crop, width, height);
+    if(width != mode.width || height != mode.height || crop.left != mode.crop.x || crop.top != mode.crop.y ||
+       (int)crop.width != mode.crop.width || (int)crop.height != mode.crop.height) {
+      Rect actual(crop.left, crop.top, crop.width, crop.height);
+      delete modeTrackers[i];
+      delete modeDetectors[i];
+      modeDetectors[i] = new TagDetector(rescaleCamera(camera, actual, width, height), tagGeometry, cacheDir);
+      modeTrackers[i] = new TagTracker(modeDetectors[i], trackerConfig);
+      camera.modes[i].crop = actual;
+      camera.modes[i].width = width;
+      camera.modes[i].height = height;
     }
+
+    currentMode = i;
+    detector = modeDetectors[i];
+    tracker = modeTrackers[i];
+    tracker->clear();
+  #endif
+}
+
+/* read the speed off the camera position and drop to the fast,
+ * low resolution mode while moving quickly; the two thresholds
+ * keep it from switching back and forth around one speed.
+ */
+void CameraPoseEstimator::selectMode(const Mat& position) {
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  if(!lastPosition.empty()) {
+    double dt = std::chrono::duration_cast<std::chrono::microseconds>(now - lastPoseTime).count() / 1e6;
+    if(dt > 0) speed = 0.7*speed + 0.3*norm(position - lastPosition)/dt;
   }
-  
-  innerSquareLength = gridSize * (SquareSideLength + GapLength) - GapLength + 2*gridBorderOffset;
-
-  // set up the four corner points
-  cur.x = 0;
-  cur.y = 0;
-  cur.z = 0;
-  testOuterSquare.push_back(cur);
-  
-  cur.x = 2*gridBorderOffset + (gridSize - 1)*GapLength + (gridSize)*SquareSideLength;
-  cur.y = 0;
-  cur.z = 0;
-  testOuterSquare.push_back(cur);
-  
-  cur.x = 2*gridBorderOffset + (gridSize - 1)*GapLength + (gridSize)*SquareSideLength;
-  cur.y = 2*gridBorderOffset + (gridSize - 1)*GapLength + (gridSize)*SquareSideLength;
-  cur.z = 0;
-  testOuterSquare.push_back(cur);
-  
-  cur.x = 0;
-  cur.y = 2*gridBorderOffset + (gridSize - 1)*GapLength + (gridSize)*SquareSideLength;
-  cur.z = 0;
-  testOuterSquare.push_back(cur);
-       
-  // set up the distortion matrices
-  distmap1 = Mat(NUMROWS, NUMCOLS, CV_16SC2);
-  distmap2 = Mat(NUMROWS, NUMCOLS, CV_16UC1);
-  
-  //initialize the distortion maps
-  initUndistortRectifyMap(cameraMatrix, distCoeffs, Mat_<double>::eye(3,3), cameraMatrix, 
-                          Size(NUMCOLS, NUMROWS), distmap1.type(), distmap1, distmap2);
+  lastPosition = position.clone();
+  lastPoseTime = now;
+
+  if(modeDetectors.size() < 2) return;
+  if(currentMode == 0 && speed > camera.fastSpeed) setMode(1);
+  else if(currentMode == 1 && speed < camera.hoverSpeed) setMode(0);
 }
 
 void CameraPoseEstimator::getImage(Mat& img) {
   Mat src, src_gray;
 
   // capture image from camera
-  #ifdef USE_ECON_CAMERA
+  #if defined(USE_FRAME_BUS)
+    // held in shared memory until the next frame is taken
+    while(!capture->next(src)) {
+      std::cerr << "NO FRAMES ON THE FRAME BUS" << std::endl;
+      std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+  #elif defined(USE_ECON_CAMERA)
     capture->readImg(src);  
   #else
     capture.read(src);
@@ -193,148 +301,47 @@ void CameraPoseEstimator::getImage(Mat& img) {
   // convert to grayscale
   cvtColor(src, src_gray, COLOR_RGB2GRAY );
 
-  // undistort the image
-  remap(src_gray, img, distmap1, distmap2, INTER_LINEAR, BORDER_CONSTANT );
-}
-
-void CameraPoseEstimator::findCandidateTags(vector<CandidateTag*>& candidateTags, Mat& img) {
-  vector<vector<Point> > contours;
-  vector<Vec4i> hierarchy;
-  vector<vector<Point> > innerContours;
-  Mat thresholded;
-
-  //Use canny to create an edge map
-  Canny(img, thresholded, 50, 100, 3);
-
-  //find the contours in the edgemap  *******THIS MIGHT BE ABLE TO BE OPTIMIZED********        
-  findContours(thresholded, contours, hierarchy, CV_RETR_TREE, CV_CHAIN_APPROX_NONE, Point(0,0));
-               
-  //find the quadrilaterals in the contours  
-  foundPatterns.clear();  
-//  foundTags.clear();    
-  for(int i = 0; i < contours.size(); i++) {
-    if(/*hierarchy[i][2] >= 0  &&*/
-       sqrt((contours[i][0].x - contours[i][contours[i].size() - 1].x)*
-       (contours[i][0].x - contours[i][contours[i].size() - 1].x) +
-       (contours[i][0].y - contours[i][contours[i].size() - 1].y)*
-       (contours[i][0].y - contours[i][contours[i].size() - 1].y)) < polygonCloseResolution
-       ){ 
-         
-      //fits a polygon to the contour
-      vector<Point> polygons;
-      approxPolyDP(contours[i], polygons, 10, true);
-            
-      //if the fit polygon is four sided
-      if(polygons.size() == 4){
-              
-        //add its inner contours to innerContours
-        int nextcont = hierarchy[i][2];
-        innerContours.clear();
-        while(nextcont >= 0){
-          vector<Point> innerpolygons;
-          approxPolyDP(contours[nextcont], innerpolygons, 10, true);
-                
-          //if the polygon has at least 4 'children'
-          if(innerpolygons.size() >= 4) {
-            innerContours.push_back(innerpolygons);
-          }
-          nextcont = hierarchy[nextcont][0];
-        }
-              
-        if(innerContours.size() < 2) continue;
-
-        //construct the pattern in the quad  
-        CandidateTag* newTag = new CandidateTag;
-        newTag->pattern = NULL_PATTERN;
-
-        vector<Point2f> imagePoints;
-        vector<Point2f> squareVector;
-        Point2f cur;
-            
-        for(int z = 0; z < 4; z++) {
-          cur.x = polygons[z].x;
-          cur.y = polygons[z].y;
-          squareVector.push_back(cur);
-
-          newTag->corner[z] = polygons[z];
-        }
+  // the recording holds frames of the configured size only
+  if(recorder && src_gray.cols == NUMCOLS && src_gray.rows == NUMROWS) recorder->write(src_gray);
 
-        solvePnP(testOuterSquare, squareVector, cameraMatrix, distCoeffs, newTag->r, newTag->t, false, CV_ITERATIVE);
-        projectPoints(testPointGrid, newTag->r, newTag->t, cameraMatrix, distCoeffs, imagePoints);
-
-        for(int z = 0; z < imagePoints.size(); z++) {
-          for(vector< vector<Point> >::iterator m = innerContours.begin(); m != innerContours.end(); ++m) {
-            if(pointPolygonTest(*m, imagePoints[z], false) >= 0) {
-              candidateHandle->set(newTag->pattern, int(z/gridSize), z%gridSize, true);
-              vector< vector<Point> >::iterator n = m;
-              --m;
-              innerContours.erase(n);
-              break;
-            }
-          }
-        }
+  // undistort the image, if the detector needs it
+  detector->undistort(src_gray, img);
+}
 
-        rotation temprot = candidateHandle->findMatchingPattern(newTag->pattern);
-        if(temprot.pattern != NULL_PATTERN) {
-          newTag->pattern = temprot.pattern;
-          foundPatterns.push_back(temprot.pattern);
-
-          tagPose tempPose;
-          double a = temprot.angle;
-
-          Mat r0 = (Mat_<double>(gridSize, 1) << 0., 0., temprot.angle*M_PI_2);
-          Mat t0 = (Mat_<double>(gridSize, 1) << ((a == 1 || a == 2)? 
-                                                   innerSquareLength : 0.),
-                                                 ((a == 2 || a == 3)?
-                                                   -innerSquareLength : 0.),
-                                                 0.); 
-
-          Mat temp;  
-        
-          // r0 and t0 transform from the coordinate system of the
-          // known tag to the coordinate system of the pattern
-          // used in solvePnP.
-
-          // r and t transform from the reference frame of the pattern 
-          // used in solvePnP to the reference frame of the camera
-              
-          // this composition transforms from the tag reference
-          // frame to the camera reference frame
- 
-          composeRT(r0, t0, newTag->r, newTag->t, r0, t0);
-
-          // inverting the above transformation gives a transformation
-          // from the coordinate system of the camera to the reference
-          // frame of the tag.
-          Rodrigues(r0, temp);
-          transpose(temp, temp);
-          tempPose.t = -temp*t0;
-          Rodrigues(temp, tempPose.r_vec);
-
-//          foundTags[temprot.pattern]=tempPose;
-          newTag->tp = tempPose.t;
-          newTag->rp = tempPose.r_vec;
-          candidateTags.push_back(newTag);
-        }
-      }
-    }       
-  }       
+/* the tags of the map near the last pose that should be in view */
+void CameraPoseEstimator::predictTags(vector<ExpectedTag>& expected) {
+  vector<SquarePattern> patterns;
+  vector<tagPose> poses;
+  Point3f position(predictPosition.at<double>(0), predictPosition.at<double>(1), predictPosition.at<double>(2));
+  tagMap->findNear(position, visibility.viewRadius, patterns, poses);
+  detector->predictTags(predictR, predictT, patterns, poses, expected);
 }
 
-void CameraPoseEstimator::filterTags(vector<CandidateTag*>& knownTags, vector<CandidateTag*>& unknownTags, vector<CandidateTag*>& candidateTags) {
+/* split the candidate tags into known and unknown tags. When tags
+ * were expected, a known tag that was not is taken to be misread;
+ * expected is empty after a full search, which keeps them all.
+ */
+void CameraPoseEstimator::filterTags(vector<CandidateTag*>& knownTags, vector<CandidateTag*>& unknownTags, vector<CandidateTag*>& candidateTags,
+                                     const vector<ExpectedTag>& expected) {
   //update the pose using the known patterns
   Mat r0, t0;
 
   for(vector<CandidateTag*>::iterator m = candidateTags.begin(); m != candidateTags.end(); ++m) {
-    rotation rot = squareHandle->findMatchingPattern((*m)->pattern);
-    if(rot.pattern != NULL_PATTERN){
+    tagPose known;
+    if(tagMap->find((*m)->pattern, known)){
+      bool wasExpected = expected.empty();
+      for(int e = 0; e < expected.size(); e++) {
+        if(expected[e].pattern == (*m)->pattern) wasExpected = true;
+      }
+      if(!wasExpected) continue;
+
       knownTags.push_back(*m);
 
       // This composes the transformation from the camera to
       // the tag with the transformation from the tag to the world
-      composeRT(       (*m)->rp,                (*m)->tp,
-                patternPose[(*m)->pattern].r_vec, patternPose[(*m)->pattern].t,
-                       (*m)->rp,                (*m)->tp);
+      composeRT((*m)->rp,    (*m)->tp,
+                known.r_vec, known.t,
+                (*m)->rp,    (*m)->tp);
     }
     else {
       unknownTags.push_back(*m);
@@ -356,7 +363,7 @@ void CameraPoseEstimator::registerUnknownTags(vector<CandidateTag*>& unknownTags
                  r0,                   t0,
               newPose.r_vec,        newPose.t);
       
-    addPattern(*squareHandle, (*m)->pattern, newPose);
+    tagMap->add((*m)->pattern, newPose);
   }       
 }
 
@@ -367,8 +374,38 @@ void CameraPoseEstimator::continuousRead(){
     Mat img;
     vector<CandidateTag*> candidateTags, knownTags, unknownTags;
     this->getImage(img);
-    this->findCandidateTags(candidateTags, img);
-    this->filterTags(knownTags, unknownTags, candidateTags);
+    // a change of mode below swaps the detector for the next frame
+    TagDetector* frameDetector = detector;
+
+    // follow the tags of the last detection if possible,
+    // and only search the whole frame when that fails
+    bool detected = false;
+    vector<ExpectedTag> expected;
+    if(!tracker->track(img, candidateTags)) {
+      // start with the tags the last pose says are in view and stop
+      // once enough are found, except for an occasional full search
+      int enough = 0;
+      if(visibility.enabled && havePrediction) {
+        this->predictTags(expected);
+        if(visibility.exploreInterval > 1 && ++detections % visibility.exploreInterval != 0) {
+          enough = visibility.enoughTags;
+        }
+      }
+
+      detector->findCandidateTags(candidateTags, img, expected, enough);
+      tracker->reset(img, candidateTags);
+      detected = true;
+
+      // a full search keeps every known tag, so a bad prediction
+      // cannot keep rejecting the tags that would correct it
+      if(enough == 0) expected.clear();
+    }
+    this->filterTags(knownTags, unknownTags, candidateTags, expected);
+
+    // nothing in a detection without a known tag is worth tracking,
+    // and the last pose no longer says what is in view
+    if(knownTags.empty()) havePrediction = false;
+    if(detected && knownTags.empty()) tracker->clear();
 
     Mat r0, t0;
     if(knownTags.size() > 0) {
@@ -380,17 +417,35 @@ void CameraPoseEstimator::continuousRead(){
 
       Mat R;
       Rodrigues(r0, R);
-      find3DPose(R, t0, pose);
+      selectMode(t0);
+
+      havePrediction = true;
+      Rodrigues(R.t(), predictR);
+      predictT = -R.t()*t0;
+      predictPosition = t0.clone();
+
+      // report the pose of the body rather than of this camera
+      Mat bodyT = R*bodyToCameraT + t0;
+      R = R*bodyToCameraR;
+      find3DPose(R, bodyT, pose);
 
       this->listAccess.lock();
       this->poseList.push_back(pose);
       this->hasNewData = true;
       this->listAccess.unlock();
+      if(notifyFd >= 0) {
+        uint64_t one = 1;
+        write(notifyFd, &one, sizeof(one));
+      }
       
       std::this_thread::sleep_for(std::chrono::milliseconds(5));
 //      std::cout << "cam pose: " << r0 << " " << t0 << std::endl;
     }
 
+    // the frame is handed over, never copied; it is not touched again
+    if(debug) debug->submit(img, candidateTags, knownTags, r0, t0, frameDetector->cameraMatrix,
+                            camera.sparseUndistort? frameDetector->distCoeffs : Mat());
+
     for(int i = 0; i < candidateTags.size(); ++i) {
       delete candidateTags[i];
     }
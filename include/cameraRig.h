@@ -0,0 +1,182 @@
+#ifndef CAMERA_RIG
+#define CAMERA_RIG
+
+/******************************************
+ * cameraRig.h
+ *
+ * This file runs one pose estimator per
+ * camera on the vehicle and combines what
+ * they see into a single pose of the body.
+ *
+ * The estimators each get a thread, run as
+ * the vision role of the realtime config
+ * and pinned to the core given in the
+ * camera's config, and share one tag map,
+ * so a tag placed by the downward camera is
+ * known to the forward camera as soon as it
+ * comes into its view. The combined pose
+ * averages the latest pose of every camera
+ * that has seen a known tag recently.
+ *
+ * Every estimator signals one eventfd when
+ * it has a new pose, so the control loop can
+ * sleep in epoll until there is one.
+ ******************************************/
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <cmath>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "config.h"
+#include "rtThread.h"
+#include "tagMap.h"
+#include "cameraPoseEstimator.h"
+
+class CameraRig {
+public:
+  CameraRig(const FlyConfig&);
+
+  void start();
+  bool record(const std::string&);
+  TagMap* getTagMap();
+  int eventFd();
+
+  // called from a single thread, like the estimator's
+  bool dataAvailable();
+  bool getPose(Pose3D&);
+
+private:
+  struct CameraPose {
+    Pose3D pose;
+    std::chrono::steady_clock::time_point time;
+    bool valid;
+  };
+
+  TagMap tagMap;
+  vector<CameraPoseEstimator*> estimators;
+  vector<int> cores;
+  ThreadConfig visionThread;
+  vector<std::thread> threads;
+  int notifyFd;
+
+  vector<CameraPose> latest;
+  bool hasNewData;
+
+  // a camera's pose is left out of the average after this long (ms)
+  static const int maxPoseAge = 100;
+};
+
+CameraRig::CameraRig(const FlyConfig& config) {
+  // add the initial tag to the tag map
+  tagPose initialPose;
+  initialPose.r_vec = (Mat_<double>(3,1) << 0.,0.,0.);
+  initialPose.t = (Mat_<double>(3,1) << 0.,0.,0.);
+  tagMap.add(INITIAL_PATTERN, initialPose);
+
+  if(!config.tagMap.empty()) tagMap.load(config.tagMap);
+  visionThread = config.realtime.vision;
+
+  vector<CameraConfig> cameras(1, config.camera);
+  cameras.insert(cameras.end(), config.extraCameras.begin(), config.extraCameras.end());
+
+  for(int i = 0; i < cameras.size(); i++) {
+    estimators.push_back(new CameraPoseEstimator(config, cameras[i], &tagMap));
+    cores.push_back(cameras[i].core);
+  }
+
+  notifyFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if(notifyFd < 0) std::cerr << "COULD NOT CREATE THE CAMERA EVENTFD" << std::endl;
+  for(int i = 0; i < estimators.size(); i++) estimators[i]->setNotifyFd(notifyFd);
+
+  if(config.debug.enabled) estimators[0]->setDebugOutput(new DebugOutput(config.debug));
+
+  CameraPose none;
+  none.valid = false;
+  latest.resize(estimators.size(), none);
+  hasNewData = false;
+}
+
+/* start every estimator on its own thread */
+void CameraRig::start() {
+  for(int i = 0; i < estimators.size(); i++) {
+    threads.push_back(std::thread(&CameraPoseEstimator::continuousRead, estimators[i]));
+
+    ThreadConfig thread = visionThread;
+    if(cores[i] >= 0) thread.core = cores[i];
+    std::ostringstream role;
+    role << "CAMERA " << i;
+    applyThreadConfig(threads.back().native_handle(), thread, role.str().c_str());
+  }
+}
+
+/* record the frames of the first camera */
+bool CameraRig::record(const std::string& fileName) {
+  return estimators[0]->record(fileName);
+}
+
+TagMap* CameraRig::getTagMap() {
+  return &tagMap;
+}
+
+/* readable when an estimator has a new pose; read it to clear it */
+int CameraRig::eventFd() {
+  return notifyFd;
+}
+
+/* collect the new poses of the estimators */
+bool CameraRig::dataAvailable() {
+  for(int i = 0; i < estimators.size(); i++) {
+    if(estimators[i]->dataAvailable()) {
+      estimators[i]->getPose(latest[i].pose);
+      latest[i].time = std::chrono::steady_clock::now();
+      latest[i].valid = true;
+      hasNewData = true;
+    }
+  }
+  return hasNewData;
+}
+
+/* average the recent poses of all of the cameras; the angles are
+ * averaged as unit vectors so they do not wrap around at pi. Returns
+ * false, leaving pose as it was, if no camera has a recent pose
+ */
+bool CameraRig::getPose(Pose3D& pose) {
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  float x = 0, y = 0, z = 0;
+  float psiSin = 0, psiCos = 0, thetaSin = 0, thetaCos = 0, phiSin = 0, phiCos = 0;
+  int n = 0;
+
+  for(int i = 0; i < latest.size(); i++) {
+    if(!latest[i].valid) continue;
+    if(std::chrono::duration_cast<std::chrono::milliseconds>(now - latest[i].time).count() > maxPoseAge) continue;
+
+    const Pose3D& p = latest[i].pose;
+    x += p.x;
+    y += p.y;
+    z += p.z;
+    psiSin += sin(p.psi);     psiCos += cos(p.psi);
+    thetaSin += sin(p.theta); thetaCos += cos(p.theta);
+    phiSin += sin(p.phi);     phiCos += cos(p.phi);
+    n++;
+  }
+
+  hasNewData = false;
+  if(n == 0) return false;
+
+  pose.x = x/n;
+  pose.y = y/n;
+  pose.z = z/n;
+  pose.psi = atan2(psiSin, psiCos);
+  pose.theta = atan2(thetaSin, thetaCos);
+  pose.phi = atan2(phiSin, phiCos);
+  return true;
+}
+
+#endif
@@ -0,0 +1,549 @@
+#ifndef FLY_CONFIG
+#define FLY_CONFIG
+
+/******************************************
+ * config.h
+ *
+ * This file describes the settings that are
+ * read at startup instead of being compiled
+ * in: the camera calibration, the tag
+ * dimensions, the tracker thresholds, the
+ * tag visibility prediction, the debug
+ * video, the PID gains, the control rate,
+ * the PWM outputs, the arm switch, the log
+ * and the scheduling of threads. Cameras
+ * after the first are listed under cameras,
+ * each read over a copy of the first.
+ * Anything missing from the file keeps the
+ * default below, which are the values the
+ * vehicle flew with before the file
+ * existed.
+ ******************************************/
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+#include "StoredPatterns.h"
+#include "rtThread.h"
+
+// a region of the sensor read out at a given frame size
+struct CaptureMode {
+  std::string name;
+  cv::Rect crop;
+  int width;
+  int height;
+};
+
+struct CameraConfig {
+  // video device number, -1 for the default of the build
+  int device;
+  // core the camera's thread is pinned to, -1 for any
+  int core;
+  // rotation (Rodrigues) and position (cm) of the camera in the
+  // body frame, taking points from the camera to the body
+  cv::Mat bodyRotation;
+  cv::Mat bodyTranslation;
+
+  int width;
+  int height;
+  // detect on the raw frame (see tagDetector.h)
+  bool sparseUndistort;
+  cv::Mat cameraMatrix;
+  cv::Mat distCoeffs;
+
+  // the sensor region the calibration above was made with
+  cv::Rect sensorCrop;
+  // modes the estimator may switch between; the first is used
+  // when hovering and the second during fast motion (cm/s)
+  std::vector<CaptureMode> modes;
+  float fastSpeed;
+  float hoverSpeed;
+};
+
+struct TagGeometry {
+  float squareSideLength;
+  float gapLength;
+  float gridBorderOffset;
+};
+
+struct TrackerConfig {
+  bool enabled;
+  // frames tracked before a full detection is forced
+  int redetectInterval;
+  // pixels a corner may miss by when tracked back
+  float maxForwardBackwardError;
+  float minSideLength;
+  // largest change in quad area from one frame to the next
+  float maxAreaChange;
+};
+
+struct VisibilityConfig {
+  // predict the tags in view from the last pose
+  bool enabled;
+  // tags further than this from the camera are not expected (cm)
+  float viewRadius;
+  // stop detecting once this many expected tags are found
+  int enoughTags;
+  // every so many detections search the whole frame anyway,
+  // so tags new to the map are still found
+  int exploreInterval;
+};
+
+struct DebugConfig {
+  bool enabled;
+  // keep every decimation-th frame of the first camera
+  int decimation;
+  // a video file, or a printf pattern for an image sequence
+  std::string output;
+  std::string fourcc;
+  double fps;
+};
+
+struct PIDGains {
+  float P;
+  float I;
+  float windupGuard;
+};
+
+struct ControlConfig {
+  // control ticks per second, run on absolute deadlines
+  double rate;
+  // seconds between timing reports, 0 for none
+  double reportInterval;
+};
+
+// the device written for each PWM output, or a regular file to run
+// without the hardware; empty for an output not driven
+struct PwmConfig {
+  std::string throttle;
+  std::string roll;
+  std::string pitch;
+  std::string yaw;
+};
+
+// the GPIO of the switch that arms the vehicle, and the sysfs GPIO
+// directory, which can be a directory of plain files to test with
+struct GpioConfig {
+  int armSwitch;
+  std::string root;
+};
+
+// where the flight log goes (see logger.h); an empty file logs to
+// the console only, and console prints each record as text as well
+struct LoggingConfig {
+  std::string file;
+  bool console;
+};
+
+// the scheduling of each kind of thread; the core of a camera,
+// if set, overrides the core of the vision role for its thread
+struct RealtimeConfig {
+  // lock all memory at startup so page faults cannot stall a thread
+  bool lockMemory;
+  ThreadConfig control;
+  ThreadConfig flow;
+  ThreadConfig capture;
+  ThreadConfig vision;
+  ThreadConfig logging;
+};
+
+struct FlyConfig {
+  CameraConfig camera;
+  std::vector<CameraConfig> extraCameras;
+  TagGeometry tag;
+  TrackerConfig tracker;
+  VisibilityConfig visibility;
+  DebugConfig debug;
+  PIDGains pitch, roll, throttle;
+  ControlConfig control;
+  PwmConfig pwm;
+  GpioConfig gpio;
+  LoggingConfig logging;
+  RealtimeConfig realtime;
+
+  // where derived tables are cached between runs, empty to disable
+  std::string cacheDir;
+  // tag map loaded at startup, empty for none
+  std::string tagMap;
+
+  FlyConfig();
+};
+
+FlyConfig::FlyConfig() {
+  camera.device = -1;
+  camera.core = -1;
+  camera.bodyRotation = cv::Mat::zeros(3, 1, CV_64F);
+  camera.bodyTranslation = cv::Mat::zeros(3, 1, CV_64F);
+  camera.width = 640;
+  camera.height = 480;
+  camera.sparseUndistort = true;
+
+  // set up the camera matrix and distortion matrix, found through camera calibration.
+  camera.cameraMatrix = (cv::Mat_<double>(3,3) << 5.7951952713850142e+02, 0., 3.1950000e+02, 0., 5.7951952713850142e+02, 2.395000e+02, 0., 0., 1.);
+  camera.distCoeffs = (cv::Mat_<double>(5,1) << 3.3071823987974308e-01, -2.5506436646233288e+00, 0., 0., 5.0980401718181261e+00);
+  camera.sensorCrop = cv::Rect(0, 0, 640, 480);
+  camera.fastSpeed = 50;
+  camera.hoverSpeed = 20;
+
+  tag.squareSideLength = 2.9;
+  tag.gapLength = 0.75;
+  tag.gridBorderOffset = 2.2;
+
+  tracker.enabled = true;
+  tracker.redetectInterval = 10;
+  tracker.maxForwardBackwardError = 1.0;
+  tracker.minSideLength = 10;
+  tracker.maxAreaChange = 1.5;
+
+  visibility.enabled = true;
+  visibility.viewRadius = 300;
+  visibility.enoughTags = 2;
+  visibility.exploreInterval = 5;
+
+  debug.enabled = false;
+  debug.decimation = 10;
+  debug.output = "tmp/debug.avi";
+  debug.fourcc = "MJPG";
+  debug.fps = 10;
+
+  pitch.P = 15;
+  pitch.I = 10;
+  pitch.windupGuard = 20;
+  roll = pitch;
+  throttle.P = 1;
+  throttle.I = 1;
+  throttle.windupGuard = 20;
+
+  control.rate = 200;
+  control.reportInterval = 10;
+
+  pwm.throttle = "/dev/pwm8";
+  pwm.roll = "/dev/pwm9";
+  pwm.pitch = "/dev/pwm10";
+  pwm.yaw = "";
+
+  gpio.armSwitch = 10;
+  gpio.root = "/sys/class/gpio";
+
+  logging.file = "tmp/fly.qlog";
+  logging.console = true;
+
+  realtime.lockMemory = true;
+  realtime.control.policy = "fifo";
+  realtime.control.priority = 80;
+  realtime.control.core = -1;
+  realtime.flow.policy = "fifo";
+  realtime.flow.priority = 70;
+  realtime.flow.core = -1;
+  realtime.capture.policy = "fifo";
+  realtime.capture.priority = 60;
+  realtime.capture.core = -1;
+  realtime.vision.policy = "other";
+  realtime.vision.priority = 0;
+  realtime.vision.core = -1;
+  realtime.logging.policy = "idle";
+  realtime.logging.priority = 0;
+  realtime.logging.core = -1;
+
+  cacheDir = "tmp";
+}
+
+/* the calibration of a camera mode, from the calibration of the
+ * mode in config. Pixel centers are mapped through the sensor, so
+ * the focal lengths scale with the binning and the principal point
+ * also moves with the crop; the distortion is unchanged since it
+ * acts on normalized coordinates.
+ */
+CameraConfig rescaleCamera(const CameraConfig& config, const cv::Rect& crop, int width, int height) {
+  CameraConfig scaled = config;
+  scaled.width = width;
+  scaled.height = height;
+
+  // calibration pixels to sensor pixels, then sensor pixels to mode pixels
+  double cx = (double)config.sensorCrop.width / config.width;
+  double cy = (double)config.sensorCrop.height / config.height;
+  double mx = (double)width / crop.width;
+  double my = (double)height / crop.height;
+
+  cv::Mat K;
+  config.cameraMatrix.convertTo(K, CV_64F);
+  K.at<double>(0,0) *= cx*mx;
+  K.at<double>(1,1) *= cy*my;
+  K.at<double>(0,2) = ((K.at<double>(0,2) + 0.5)*cx + config.sensorCrop.x - crop.x)*mx - 0.5;
+  K.at<double>(1,2) = ((K.at<double>(1,2) + 0.5)*cy + config.sensorCrop.y - crop.y)*my - 0.5;
+  scaled.cameraMatrix = K;
+
+  return scaled;
+}
+
+static void readRect(const cv::FileNode& node, cv::Rect& rect) {
+  if(node.size() == 4) rect = cv::Rect((int)node[0], (int)node[1], (int)node[2], (int)node[3]);
+}
+
+static void writeRect(cv::FileStorage& fs, const char* name, const cv::Rect& rect) {
+  fs << name << "[:" << rect.x << rect.y << rect.width << rect.height << "]";
+}
+
+/* read a node only if it is present, so missing keys keep their defaults */
+template<typename T>
+static void readNode(const cv::FileNode& node, T& value) {
+  if(!node.empty()) node >> value;
+}
+
+static void readNode(const cv::FileNode& node, bool& value) {
+  if(!node.empty()) value = (int)node != 0;
+}
+
+static void readNode(const cv::FileNode& node, std::string& value) {
+  if(!node.empty()) value = (std::string)node;
+}
+
+static void readGains(const cv::FileNode& node, PIDGains& gains) {
+  readNode(node["P"], gains.P);
+  readNode(node["I"], gains.I);
+  readNode(node["windupGuard"], gains.windupGuard);
+}
+
+static void writeGains(cv::FileStorage& fs, const char* name, const PIDGains& gains) {
+  fs << name << "{" << "P" << gains.P << "I" << gains.I << "windupGuard" << gains.windupGuard << "}";
+}
+
+static void readThread(const cv::FileNode& node, ThreadConfig& thread) {
+  readNode(node["policy"], thread.policy);
+  readNode(node["priority"], thread.priority);
+  readNode(node["core"], thread.core);
+}
+
+static void writeThread(cv::FileStorage& fs, const char* name, const ThreadConfig& thread) {
+  fs << name << "{" << "policy" << thread.policy << "priority" << thread.priority << "core" << thread.core << "}";
+}
+
+static void readCamera(const cv::FileNode& camera, CameraConfig& config) {
+  readNode(camera["device"], config.device);
+  readNode(camera["core"], config.core);
+  readNode(camera["bodyRotation"], config.bodyRotation);
+  readNode(camera["bodyTranslation"], config.bodyTranslation);
+  config.bodyRotation.convertTo(config.bodyRotation, CV_64F);
+  config.bodyTranslation.convertTo(config.bodyTranslation, CV_64F);
+  readNode(camera["width"], config.width);
+  readNode(camera["height"], config.height);
+  readNode(camera["sparseUndistort"], config.sparseUndistort);
+  readNode(camera["cameraMatrix"], config.cameraMatrix);
+  readNode(camera["distCoeffs"], config.distCoeffs);
+  config.cameraMatrix.convertTo(config.cameraMatrix, CV_64F);
+  config.distCoeffs.convertTo(config.distCoeffs, CV_64F);
+  readRect(camera["sensorCrop"], config.sensorCrop);
+  readNode(camera["fastSpeed"], config.fastSpeed);
+  readNode(camera["hoverSpeed"], config.hoverSpeed);
+
+  cv::FileNode modes = camera["modes"];
+  if(!modes.empty()) config.modes.clear();
+  for(cv::FileNodeIterator i = modes.begin(); i != modes.end(); ++i) {
+    CaptureMode mode;
+    mode.name = (std::string)(*i)["name"];
+    readRect((*i)["crop"], mode.crop);
+    mode.width = (int)(*i)["width"];
+    mode.height = (int)(*i)["height"];
+    config.modes.push_back(mode);
+  }
+}
+
+static void writeCamera(cv::FileStorage& fs, const CameraConfig& camera) {
+  fs << "{"
+     << "device" << camera.device
+     << "core" << camera.core
+     << "bodyRotation" << camera.bodyRotation
+     << "bodyTranslation" << camera.bodyTranslation
+     << "width" << camera.width
+     << "height" << camera.height
+     << "sparseUndistort" << (int)camera.sparseUndistort
+     << "cameraMatrix" << camera.cameraMatrix
+     << "distCoeffs" << camera.distCoeffs;
+  writeRect(fs, "sensorCrop", camera.sensorCrop);
+  fs << "fastSpeed" << camera.fastSpeed
+     << "hoverSpeed" << camera.hoverSpeed;
+  fs << "modes" << "[";
+  for(size_t i = 0; i < camera.modes.size(); i++) {
+    const CaptureMode& mode = camera.modes[i];
+    fs << "{" << "name" << mode.name;
+    writeRect(fs, "crop", mode.crop);
+    fs << "width" << mode.width << "height" << mode.height << "}";
+  }
+  fs << "]" << "}";
+}
+
+/* read a config file over the defaults */
+bool loadConfig(const std::string& fileName, FlyConfig& config) {
+  cv::FileStorage fs(fileName, cv::FileStorage::READ);
+  if(!fs.isOpened()) {
+    std::cerr << "COULD NOT OPEN CONFIG " << fileName << ", USING DEFAULTS" << std::endl;
+    return false;
+  }
+
+  readCamera(fs["camera"], config.camera);
+
+  cv::FileNode cameras = fs["cameras"];
+  if(!cameras.empty()) config.extraCameras.clear();
+  for(cv::FileNodeIterator i = cameras.begin(); i != cameras.end(); ++i) {
+    CameraConfig extra = config.camera;
+    extra.modes.clear();
+    readCamera(*i, extra);
+    config.extraCameras.push_back(extra);
+  }
+
+  cv::FileNode tag = fs["tag"];
+  readNode(tag["squareSideLength"], config.tag.squareSideLength);
+  readNode(tag["gapLength"], config.tag.gapLength);
+  readNode(tag["gridBorderOffset"], config.tag.gridBorderOffset);
+
+  cv::FileNode tracker = fs["tracker"];
+  readNode(tracker["enabled"], config.tracker.enabled);
+  readNode(tracker["redetectInterval"], config.tracker.redetectInterval);
+  readNode(tracker["maxForwardBackwardError"], config.tracker.maxForwardBackwardError);
+  readNode(tracker["minSideLength"], config.tracker.minSideLength);
+  readNode(tracker["maxAreaChange"], config.tracker.maxAreaChange);
+
+  cv::FileNode visibility = fs["visibility"];
+  readNode(visibility["enabled"], config.visibility.enabled);
+  readNode(visibility["viewRadius"], config.visibility.viewRadius);
+  readNode(visibility["enoughTags"], config.visibility.enoughTags);
+  readNode(visibility["exploreInterval"], config.visibility.exploreInterval);
+
+  cv::FileNode debug = fs["debug"];
+  readNode(debug["enabled"], config.debug.enabled);
+  readNode(debug["decimation"], config.debug.decimation);
+  readNode(debug["output"], config.debug.output);
+  readNode(debug["fourcc"], config.debug.fourcc);
+  readNode(debug["fps"], config.debug.fps);
+  if(config.debug.decimation < 1) config.debug.decimation = 1;
+  if(config.debug.fourcc.size() != 4) config.debug.fourcc = "MJPG";
+
+  cv::FileNode pid = fs["pid"];
+  readGains(pid["pitch"], config.pitch);
+  readGains(pid["roll"], config.roll);
+  readGains(pid["throttle"], config.throttle);
+
+  cv::FileNode control = fs["control"];
+  readNode(control["rate"], config.control.rate);
+  readNode(control["reportInterval"], config.control.reportInterval);
+  if(config.control.rate <= 0) config.control.rate = 200;
+
+  cv::FileNode pwm = fs["pwm"];
+  readNode(pwm["throttle"], config.pwm.throttle);
+  readNode(pwm["roll"], config.pwm.roll);
+  readNode(pwm["pitch"], config.pwm.pitch);
+  readNode(pwm["yaw"], config.pwm.yaw);
+
+  cv::FileNode gpio = fs["gpio"];
+  readNode(gpio["armSwitch"], config.gpio.armSwitch);
+  readNode(gpio["root"], config.gpio.root);
+
+  cv::FileNode logging = fs["logging"];
+  readNode(logging["file"], config.logging.file);
+  readNode(logging["console"], config.logging.console);
+
+  cv::FileNode realtime = fs["realtime"];
+  readNode(realtime["lockMemory"], config.realtime.lockMemory);
+  readThread(realtime["control"], config.realtime.control);
+  readThread(realtime["flow"], config.realtime.flow);
+  readThread(realtime["capture"], config.realtime.capture);
+  readThread(realtime["vision"], config.realtime.vision);
+  readThread(realtime["logging"], config.realtime.logging);
+
+  readNode(fs["cacheDir"], config.cacheDir);
+  readNode(fs["tagMap"], config.tagMap);
+
+  return true;
+}
+
+/* write a complete config file */
+bool saveConfig(const std::string& fileName, const FlyConfig& config) {
+  cv::FileStorage fs(fileName, cv::FileStorage::WRITE);
+  if(!fs.isOpened()) {
+    std::cerr << "COULD NOT WRITE CONFIG " << fileName << std::endl;
+    return false;
+  }
+
+  fs << "camera";
+  writeCamera(fs, config.camera);
+  fs << "cameras" << "[";
+  for(size_t i = 0; i < config.extraCameras.size(); i++) {
+    writeCamera(fs, config.extraCameras[i]);
+  }
+  fs << "]";
+
+  fs << "tag" << "{"
+     << "squareSideLength" << config.tag.squareSideLength
+     << "gapLength" << config.tag.gapLength
+     << "gridBorderOffset" << config.tag.gridBorderOffset
+     << "}";
+
+  fs << "tracker" << "{"
+     << "enabled" << (int)config.tracker.enabled
+     << "redetectInterval" << config.tracker.redetectInterval
+     << "maxForwardBackwardError" << config.tracker.maxForwardBackwardError
+     << "minSideLength" << config.tracker.minSideLength
+     << "maxAreaChange" << config.tracker.maxAreaChange
+     << "}";
+
+  fs << "visibility" << "{"
+     << "enabled" << (int)config.visibility.enabled
+     << "viewRadius" << config.visibility.viewRadius
+     << "enoughTags" << config.visibility.enoughTags
+     << "exploreInterval" << config.visibility.exploreInterval
+     << "}";
+
+  fs << "debug" << "{"
+     << "enabled" << (int)config.debug.enabled
+     << "decimation" << config.debug.decimation
+     << "output" << config.debug.output
+     << "fourcc" << config.debug.fourcc
+     << "fps" << config.debug.fps
+     << "}";
+
+  fs << "pid" << "{";
+  writeGains(fs, "pitch", config.pitch);
+  writeGains(fs, "roll", config.roll);
+  writeGains(fs, "throttle", config.throttle);
+  fs << "}";
+
+  fs << "control" << "{"
+     << "rate" << config.control.rate
+     << "reportInterval" << config.control.reportInterval
+     << "}";
+
+  fs << "pwm" << "{"
+     << "throttle" << config.pwm.throttle
+     << "roll" << config.pwm.roll
+     << "pitch" << config.pwm.pitch
+     << "yaw" << config.pwm.yaw
+     << "}";
+
+  fs << "gpio" << "{"
+     << "armSwitch" << config.gpio.armSwitch
+     << "root" << config.gpio.root
+     << "}";
+
+  fs << "logging" << "{"
+     << "file" << config.logging.file
+     << "console" << (int)config.logging.console
+     << "}";
+
+  fs << "realtime" << "{" << "lockMemory" << (int)config.realtime.lockMemory;
+  writeThread(fs, "control", config.realtime.control);
+  writeThread(fs, "flow", config.realtime.flow);
+  writeThread(fs, "capture", config.realtime.capture);
+  writeThread(fs, "vision", config.realtime.vision);
+  writeThread(fs, "logging", config.realtime.logging);
+  fs << "}";
+
+  fs << "cacheDir" << config.cacheDir;
+  fs << "tagMap" << config.tagMap;
+
+  return true;
+}
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef CONTROL_SCHEDULER_H
+#define CONTROL_SCHEDULER_H
+
+/*
+  Runs the control loop at a fixed rate. A timerfd expires on absolute
+  deadlines, start + k * period, so the ticks do not drift with however
+  long each pass takes, and the controller can use the period as its
+  dt. Each tick records how late it woke (jitter), how long the pass
+  took (execution) and how many deadlines passed without a tick
+  (missed), so the headroom left in the loop can be read off.
+*/
+
+#include <stdint.h>
+#include <ostream>
+
+#include "histogram.h"
+
+class ControlScheduler
+{
+public:
+    ControlScheduler(double rate);
+    ~ControlScheduler();
+    bool isOpen();
+    int fd();
+    float period();
+
+    bool beginTick();
+    void endTick();
+
+    uint64_t ticks();
+    uint64_t missed();
+    const Histogram& jitter();
+    const Histogram& execution();
+    void report(std::ostream& out);
+private:
+    int timer;
+    int64_t period_ns;
+    int64_t start_ns;
+    uint64_t deadlines;
+    uint64_t tick_count;
+    uint64_t missed_count;
+    int64_t tick_start_ns;
+
+    Histogram jitter_us;
+    Histogram execution_us;
+    Histogram missed_per_tick;
+};
+
+#endif
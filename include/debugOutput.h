@@ -0,0 +1,252 @@
+#ifndef DEBUG_OUTPUT
+#define DEBUG_OUTPUT
+
+/******************************************
+ * debugOutput.h
+ *
+ * This file describes the debug video of the
+ * vision system: every n-th frame with the
+ * quads found in it, their decoded patterns
+ * and the axes of the world drawn over it.
+ *
+ * The vision loop hands over its frame by
+ * reference into a single slot and carries
+ * on; a low priority thread draws and encodes
+ * whatever is in the slot. If that thread is
+ * still busy, the frame in the slot is simply
+ * replaced, so a slow disk or encoder drops
+ * frames from the video instead of slowing
+ * down the pose estimate.
+ ******************************************/
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/highgui/highgui.hpp"
+#include "opencv2/calib3d/calib3d.hpp"
+
+#include "config.h"
+#include "tagDetector.h"
+
+using namespace cv;
+
+class DebugOutput {
+public:
+  DebugOutput(const DebugConfig&);
+  ~DebugOutput();
+
+  void submit(const Mat&, const vector<CandidateTag*>&, const vector<CandidateTag*>&,
+              const Mat&, const Mat&, const Mat&, const Mat&);
+  int dropped();
+
+private:
+  struct DrawnTag {
+    Point2f corner[4];
+    SquarePattern pattern;
+    bool known;
+  };
+
+  struct DebugFrame {
+    Mat image;
+    vector<DrawnTag> tags;
+    // from the world to the camera, empty without a pose
+    Mat rw;
+    Mat tw;
+    Mat cameraMatrix;
+    Mat distCoeffs;
+  };
+
+  void run();
+  void draw(const DebugFrame&, Mat&);
+  void write(const Mat&);
+
+  DebugConfig config;
+  int frameCount;
+  int written;
+  std::atomic<int> droppedFrames;
+
+  DebugFrame slot;
+  bool slotFull;
+  bool stopping;
+  std::mutex slotLock;
+  std::condition_variable slotReady;
+  std::thread worker;
+
+  VideoWriter video;
+  Size videoSize;
+};
+
+DebugOutput::DebugOutput(const DebugConfig& config) {
+  this->config = config;
+  frameCount = 0;
+  written = 0;
+  droppedFrames = 0;
+  slotFull = false;
+  stopping = false;
+
+  worker = std::thread(&DebugOutput::run, this);
+}
+
+DebugOutput::~DebugOutput() {
+  {
+    std::lock_guard<std::mutex> guard(slotLock);
+    stopping = true;
+  }
+  slotReady.notify_one();
+  worker.join();
+}
+
+/* offer a frame to the debug video. Only every decimation-th frame
+ * is kept, and it is dropped rather than waited for if the drawing
+ * thread holds the slot. The image is kept by reference, so it must
+ * not be written to afterwards. r0 and t0 take the camera to the
+ * world and are empty without a pose.
+ */
+void DebugOutput::submit(const Mat& image, const vector<CandidateTag*>& candidateTags,
+                         const vector<CandidateTag*>& knownTags, const Mat& r0, const Mat& t0,
+                         const Mat& cameraMatrix, const Mat& distCoeffs) {
+  if(++frameCount % config.decimation != 0) return;
+
+  std::unique_lock<std::mutex> guard(slotLock, std::try_to_lock);
+  if(!guard.owns_lock()) {
+    droppedFrames++;
+    return;
+  }
+  if(slotFull) droppedFrames++;
+
+  slot.image = image;
+  slot.tags.clear();
+  for(int i = 0; i < candidateTags.size(); i++) {
+    DrawnTag tag;
+    for(int z = 0; z < 4; z++) tag.corner[z] = candidateTags[i]->imageCorner[z];
+    tag.pattern = candidateTags[i]->pattern;
+    tag.known = std::find(knownTags.begin(), knownTags.end(), candidateTags[i]) != knownTags.end();
+    slot.tags.push_back(tag);
+  }
+
+  slot.rw = Mat();
+  slot.tw = Mat();
+  if(!r0.empty()) {
+    Mat R;
+    Rodrigues(r0, R);
+    R = R.t();
+    Rodrigues(R, slot.rw);
+    slot.tw = -R*t0;
+  }
+  slot.cameraMatrix = cameraMatrix;
+  slot.distCoeffs = distCoeffs;
+
+  slotFull = true;
+  guard.unlock();
+  slotReady.notify_one();
+}
+
+int DebugOutput::dropped() {
+  return droppedFrames;
+}
+
+void DebugOutput::run() {
+  // only draw when nothing else wants the core
+  sched_param param;
+  param.sched_priority = 0;
+  if(pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) != 0) {
+    std::cerr << "COULD NOT LOWER THE PRIORITY OF THE DEBUG OUTPUT" << std::endl;
+  }
+
+  for(;;) {
+    DebugFrame frame;
+    {
+      std::unique_lock<std::mutex> guard(slotLock);
+      slotReady.wait(guard, [this]{ return slotFull || stopping; });
+      if(!slotFull) return;
+      std::swap(frame, slot);
+      slotFull = false;
+    }
+
+    Mat drawn;
+    draw(frame, drawn);
+    write(drawn);
+  }
+}
+
+void DebugOutput::draw(const DebugFrame& frame, Mat& drawn) {
+  if(frame.image.channels() == 1) cvtColor(frame.image, drawn, COLOR_GRAY2BGR);
+  else                            drawn = frame.image.clone();
+
+  for(int i = 0; i < frame.tags.size(); i++) {
+    const DrawnTag& tag = frame.tags[i];
+    Scalar color = tag.known? Scalar(0, 255, 0) : Scalar(0, 255, 255);
+    for(int z = 0; z < 4; z++) {
+      line(drawn, tag.corner[z], tag.corner[(z + 1) % 4], color, 2);
+    }
+
+    std::ostringstream id;
+    id << "0x" << std::hex << tag.pattern;
+    Point2f center = (tag.corner[0] + tag.corner[1] + tag.corner[2] + tag.corner[3])*0.25f;
+    putText(drawn, id.str(), center, FONT_HERSHEY_SIMPLEX, 0.5, color, 1);
+  }
+
+  // the world axes, 10 cm long, x red, y green, z blue
+  if(!frame.rw.empty()) {
+    vector<Point3f> axes;
+    axes.push_back(Point3f(0, 0, 0));
+    axes.push_back(Point3f(10, 0, 0));
+    axes.push_back(Point3f(0, 10, 0));
+    axes.push_back(Point3f(0, 0, 10));
+    vector<Point2f> image;
+    projectPoints(axes, frame.rw, frame.tw, frame.cameraMatrix, frame.distCoeffs, image);
+    line(drawn, image[0], image[1], Scalar(0, 0, 255), 2);
+    line(drawn, image[0], image[2], Scalar(0, 255, 0), 2);
+    line(drawn, image[0], image[3], Scalar(255, 0, 0), 2);
+  }
+
+  std::ostringstream status;
+  status << "dropped " << droppedFrames;
+  putText(drawn, status.str(), Point(5, 15), FONT_HERSHEY_SIMPLEX, 0.5, Scalar(255, 255, 255), 1);
+}
+
+/* write to a video, or to an image sequence when the output
+ * is a printf pattern such as tmp/debug%05d.jpg
+ */
+void DebugOutput::write(const Mat& drawn) {
+  if(config.output.find('%') != std::string::npos) {
+    char fileName[512];
+    snprintf(fileName, sizeof(fileName), config.output.c_str(), written++);
+    imwrite(fileName, drawn);
+    return;
+  }
+
+  if(!video.isOpened()) {
+    const std::string& c = config.fourcc;
+    video.open(config.output, CV_FOURCC(c[0], c[1], c[2], c[3]), config.fps, drawn.size());
+    if(!video.isOpened()) {
+      std::cerr << "COULD NOT OPEN DEBUG VIDEO " << config.output << std::endl;
+      return;
+    }
+    videoSize = drawn.size();
+  }
+
+  // a change of camera mode changes the frame size, the video cannot
+  if(drawn.size() != videoSize) {
+    Mat scaled;
+    resize(drawn, scaled, videoSize);
+    video << scaled;
+  }
+  else {
+    video << drawn;
+  }
+  written++;
+}
+
+#endif
@@ -13,6 +13,11 @@
  * This code is based on the code provided by econ
  * camera systems.
  *
+ * The sensor region read out and the frame size can
+ * be changed at runtime with setMode; the driver bins
+ * or skips rows and columns to scale the crop down to
+ * the frame size, so less data crosses the bus.
+ *
  *****************************************************/
 
 #include <iostream>
@@ -30,12 +35,14 @@
 
 #include <string>
 #include <sstream>
+#include <string.h>
 
 #include <chrono>
 #include <iostream>
 
 #include <linux/videodev2.h>
 #include "opencv2/core/core.hpp"
+#include "logger.h"
 
 #define NOTDEBUG
 
@@ -52,6 +59,8 @@ struct camera {
 	struct v4l2_format fmt;
 	struct v4l2_buffer buf;
 	struct { int w; int h; int frameSize; } res;
+	struct v4l2_rect crop;
+	int bufferSize;
 	int device;
 };
 
@@ -61,6 +70,8 @@ public:
 	~econ();
 	int readImg(cv::Mat&);
 	int readCV(cv::Mat&);
+	int setMode(const struct v4l2_rect&, int width, int height);
+	int getMode(struct v4l2_rect&, int& width, int& height);
 
 private:
 	camera* cam;
@@ -99,7 +110,7 @@ econ::econ (int videoDeviceNum, int width, int height) {
 	cam->device = open(deviceName.str().c_str(), O_RDWR | O_NONBLOCK, 0);
  //       fcnl(cam->device, FL_SET, O_NONBLOCK);
 	if (cam->device < 0) {
-		std::cerr << "COULD NOT OPEN VIDEO DEVICE " << deviceName << std::endl;
+		std::cerr << "COULD NOT OPEN VIDEO DEVICE " << deviceName.str() << std::endl;
 		exit(-1);
 	}
 		
@@ -114,7 +125,8 @@ econ::econ (int videoDeviceNum, int width, int height) {
 		exit(-1);
 	}
 /**/
-	cam->buffer = new uint8_t[frameSize*2];
+	cam->bufferSize = frameSize*2;
+	cam->buffer = new uint8_t[cam->bufferSize];
 	if(!cam->buffer) {
 		std::cerr << "COULD NOT ALLOCATE RAW DATA BUFFER" << std::endl;
 		exit(-1);
@@ -138,6 +150,21 @@ econ::econ (int videoDeviceNum, int width, int height) {
 		exit(-1);
 	}
 
+	// start from whatever part of the sensor the driver reads by default
+	struct v4l2_selection sel;
+	memset(&sel, 0, sizeof(sel));
+	sel.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	sel.target = V4L2_SEL_TGT_CROP;
+	if (ioctl(cam->device, VIDIOC_G_SELECTION, &sel) == 0) {
+		cam->crop = sel.r;
+	}
+	else {
+		cam->crop.left = 0;
+		cam->crop.top = 0;
+		cam->crop.width = cam->fmt.fmt.pix.width;
+		cam->crop.height = cam->fmt.fmt.pix.height;
+	}
+
 	#ifdef DEBUG
 	std::cout << "CAMERA SUCCESSFULLY SET UP" << std::endl;
 	#endif
@@ -157,6 +184,94 @@ econ::~econ () {
 	delete cam;
 }
 
+/* setMode
+   select the region of the sensor to read out and the size of
+   the frames it is scaled to. The driver may adjust both; getMode
+   returns what was actually set.
+
+   arguments:
+     crop  : the region of the sensor, in sensor pixels
+     width : the width of a frame
+     height: the height of a frame
+   returns
+     0 on success, -1 if the driver refused the frame size
+*/
+int econ::setMode (const struct v4l2_rect& crop, int width, int height) {
+
+	struct v4l2_selection sel;
+	memset(&sel, 0, sizeof(sel));
+	sel.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	sel.target = V4L2_SEL_TGT_CROP;
+	sel.r = crop;
+	if (ioctl(cam->device, VIDIOC_S_SELECTION, &sel) < 0) {
+		// drivers older than the selection API only know cropping
+		struct v4l2_crop c;
+		c.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		c.c = crop;
+		if (ioctl(cam->device, VIDIOC_S_CROP, &c) < 0) {
+			std::cerr << "COULD NOT SET SENSOR CROP, SCALING ONLY" << std::endl;
+		}
+	}
+
+	struct v4l2_format fmt = cam->fmt;
+	fmt.fmt.pix.width = width;
+	fmt.fmt.pix.height = height;
+	fmt.fmt.pix.sizeimage = width * height * 2;
+	if (ioctl(cam->device, VIDIOC_S_FMT, &fmt) < 0) {
+		std::cerr << "COULD NOT SET DEVICE FORMAT " << width << "x" << height << std::endl;
+		return -1;
+	}
+
+	// read back what the driver settled on
+	if (ioctl(cam->device, VIDIOC_G_FMT, &fmt) == 0) {
+		cam->fmt = fmt;
+	}
+	memset(&sel, 0, sizeof(sel));
+	sel.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	sel.target = V4L2_SEL_TGT_CROP;
+	if (ioctl(cam->device, VIDIOC_G_SELECTION, &sel) == 0) {
+		cam->crop = sel.r;
+	}
+	else {
+		cam->crop = crop;
+	}
+
+	cam->res.w = cam->fmt.fmt.pix.width;
+	cam->res.h = cam->fmt.fmt.pix.height;
+	cam->res.frameSize = cam->res.w * cam->res.h;
+
+	if ((int)cam->fmt.fmt.pix.sizeimage > cam->bufferSize) {
+		delete [] cam->buffer;
+		cam->bufferSize = cam->fmt.fmt.pix.sizeimage;
+		cam->buffer = new uint8_t[cam->bufferSize];
+	}
+
+	#ifdef DEBUG
+	std::cout << "CAMERA MODE " << cam->res.w << "x" << cam->res.h << " FROM "
+	          << cam->crop.width << "x" << cam->crop.height << "+"
+	          << cam->crop.left << "+" << cam->crop.top << std::endl;
+	#endif
+
+	return 0;
+}
+
+/* getMode
+   the sensor region and frame size currently in use
+
+   arguments:
+     crop  : set to the region of the sensor, in sensor pixels
+     width : set to the width of a frame
+     height: set to the height of a frame
+   returns
+     0
+*/
+int econ::getMode (struct v4l2_rect& crop, int& width, int& height) {
+	crop = cam->crop;
+	width = cam->res.w;
+	height = cam->res.h;
+	return 0;
+}
+
 int econ::readImg (cv::Mat& img) {
 //!	this->readRGB();  
 
@@ -192,7 +307,7 @@ int econ::readRaw () {
 	auto end = std::chrono::high_resolution_clock::now();
 	auto elapsed = end - start;
 
-	std::cout << elapsed.count() << std::endl;	
+	logRecord(LOG_FRAME_READ, std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
 
 	if(readBits != cam->fmt.fmt.pix.sizeimage) {
 		std::cerr << "Read bits != image size" << std::endl;
@@ -256,6 +371,9 @@ int econ::convertBuff2CV (cv::Mat* img) {
     int height = cam->fmt.fmt.pix.height;
     char gb, rg, r, g, b;
 
+    // the frame size changes with the camera mode
+    img->create(height, width, CV_8UC3);
+
     for(int i = 0; i < height; i++) {
         for(int j = 0; j < width; j++) {
 
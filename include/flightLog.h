@@ -0,0 +1,139 @@
+#ifndef FLIGHT_LOG_H
+#define FLIGHT_LOG_H
+
+/*
+  A compact, columnar flight log for storing and analysing long
+  flights. A log holds one or more streams, such as the control
+  outputs or the position estimate, each a table of rows with a time
+  and a fixed set of typed channels. The schema, every stream with the
+  name, encoding and precision of its channels, is in the header.
+
+  Rows are stored in chunks of up to FLIGHT_LOG_CHUNK_ROWS rows of one
+  stream, and within a chunk column by column, so one channel can be
+  read without decoding the others. Slowly changing channels, such as
+  the PWM outputs, are stored as fixed point: each value is rounded to
+  a number of decimals, and the change from the row before is written
+  as a zigzag varint, so a channel that holds still costs a byte a
+  row. Fast, noisy channels are stored as plain floats. Every chunk
+  starts from zero, so it can be decoded on its own.
+
+  An index at the end of the file gives the offset, stream, row count
+  and first and last time of every chunk, so a reader can go straight
+  to the chunks covering a stretch of the flight. The reader maps the
+  file rather than reading it.
+
+    header  FLIGHT_LOG_MAGIC, u16 streams, then per stream
+            name, u16 channels, then per channel name, u8 encoding,
+            i8 decimals; names are a u8 length and the bytes
+    chunk   u16 stream, u32 rows, then the time column and one column
+            per channel, each a u32 length and the bytes
+    index   per chunk u64 offset, u16 stream, u32 rows,
+            u64 first time, u64 last time
+    trailer u64 index offset, u32 chunks, FLIGHT_LOG_END
+
+  Integers are little endian, as on the vehicle.
+*/
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define FLIGHT_LOG_MAGIC "QFLT0001"
+#define FLIGHT_LOG_END "QFLTEND1"
+#define FLIGHT_LOG_CHUNK_ROWS 4096
+#define FLIGHT_LOG_MAX_DECIMALS 9
+
+enum FlightLogEncoding{
+    // rounded to decimals places, stored as the varint change from the row before
+    FLIGHT_LOG_DELTA = 1,
+    // stored as written, 4 bytes a row
+    FLIGHT_LOG_FLOAT,
+};
+
+struct FlightLogChannel{
+    std::string name;
+    uint8_t encoding;
+    int8_t decimals;
+};
+
+struct FlightLogStream{
+    std::string name;
+    std::vector<FlightLogChannel> channels;
+};
+
+struct FlightLogChunk{
+    uint64_t offset;
+    uint16_t stream;
+    uint32_t rows;
+    uint64_t first_us;
+    uint64_t last_us;
+};
+
+FlightLogChannel flightLogChannel(const std::string& name, uint8_t encoding, int decimals = 0);
+
+class FlightLogWriter
+{
+public:
+    FlightLogWriter();
+    ~FlightLogWriter();
+
+    // streams are added before the log is opened
+    int addStream(const std::string& name, const std::vector<FlightLogChannel>& channels);
+    bool open(const std::string& fileName);
+    bool write(int stream, uint64_t time_us, const double* values);
+    bool close();
+    uint64_t bytes() const;
+
+private:
+    struct Pending{
+        std::vector<uint64_t> times;
+        // row by row, a value for every channel
+        std::vector<double> values;
+    };
+
+    bool flush(int stream);
+    bool put(const void* data, size_t size);
+
+    FILE* out;
+    bool failed;
+    uint64_t offset;
+    std::vector<FlightLogStream> streams;
+    std::vector<Pending> pending;
+    std::vector<FlightLogChunk> index;
+    std::vector<uint8_t> column;
+    std::vector<uint8_t> chunk;
+};
+
+class FlightLogReader
+{
+public:
+    FlightLogReader();
+    ~FlightLogReader();
+
+    bool open(const std::string& fileName);
+    void close();
+    bool isOpen() const;
+
+    const std::vector<FlightLogStream>& streams() const;
+    int findStream(const std::string& name) const;
+    int findChannel(int stream, const std::string& name) const;
+
+    const std::vector<FlightLogChunk>& chunks() const;
+    uint64_t rows(int stream) const;
+    size_t findChunk(int stream, uint64_t time_us) const;
+
+    bool readTimes(size_t chunk, std::vector<uint64_t>& times) const;
+    bool readChannel(size_t chunk, int channel, std::vector<double>& values) const;
+
+private:
+    bool column(size_t chunk, int column, const uint8_t** data, size_t* size) const;
+
+    uint8_t* map;
+    size_t length;
+    std::vector<FlightLogStream> schema;
+    std::vector<FlightLogChunk> index;
+};
+
+#endif
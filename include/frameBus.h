@@ -0,0 +1,375 @@
+#ifndef FRAME_BUS
+#define FRAME_BUS
+
+/******************************************
+ * frameBus.h
+ *
+ * This file describes the frame bus: a ring
+ * of fixed frame slots in POSIX shared memory
+ * that capture_daemon fills from the camera
+ * and any number of processes read from
+ * without copying the pixels.
+ *
+ * Every reader registers as a client and
+ * owns one bit of each slot's holder mask.
+ * A reader sets its bit on the slot it is
+ * using; the daemon only writes into a slot
+ * with no bits set, claiming it with a bit of
+ * its own, so a frame never changes under a
+ * reader and readers never wait for one
+ * another. The bits of a reader that dies are
+ * cleared by the daemon, so a crashing client
+ * cannot pin slots forever.
+ *
+ * Readers sleep on a futex on the count of
+ * published frames until a new frame comes.
+ ******************************************/
+
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <chrono>
+#include <atomic>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <limits.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "opencv2/core/core.hpp"
+
+const char FRAME_BUS_MAGIC[8] = {'Q','F','B','U','S','0','0','1'};
+
+// one bit per reader; the top bit marks a slot being written
+const int frameBusMaxClients = 31;
+const uint32_t frameBusWriterBit = 1u << 31;
+
+struct FrameBusHeader {
+  char magic[8];
+  uint32_t width;
+  uint32_t height;
+  uint32_t type;
+  uint32_t numSlots;
+  uint64_t slotBytes;
+  uint64_t dataOffset;
+
+  // frames published so far; readers wait on it
+  std::atomic<uint32_t> published;
+  // the slot holding the newest frame, -1 before the first
+  std::atomic<int32_t> latest;
+  // the process id of each reader, 0 for a free client bit
+  std::atomic<int32_t> clients[frameBusMaxClients];
+};
+
+struct FrameBusSlot {
+  std::atomic<uint32_t> holders;
+  uint32_t reserved;
+  // the count of published frames when this one was, and
+  // the capture time in microseconds on the steady clock
+  std::atomic<uint64_t> frame;
+  int64_t timestamp;
+};
+
+/* the shared memory name of the bus for a video device */
+std::string frameBusName(int device) {
+  std::ostringstream name;
+  name << "/fly_frames" << device;
+  return name.str();
+}
+
+static long frameBusFutex(std::atomic<uint32_t>* word, int op, uint32_t value, const struct timespec* timeout) {
+  return syscall(SYS_futex, (uint32_t*)word, op, value, timeout, NULL, 0);
+}
+
+class FrameBusWriter {
+public:
+  FrameBusWriter(const std::string& name, int width, int height, int type, int numSlots);
+  ~FrameBusWriter();
+
+  bool isOpen();
+  cv::Mat beginFrame();
+  void commitFrame();
+  void abortFrame();
+  int reclaim();
+
+private:
+  std::string name;
+  uint8_t* map;
+  size_t mapLength;
+  FrameBusHeader* header;
+  FrameBusSlot* slots;
+  int writing;
+  int next;
+};
+
+class FrameBusReader {
+public:
+  FrameBusReader(const std::string& name);
+  ~FrameBusReader();
+
+  bool isOpen();
+  bool next(cv::Mat&, int timeoutMs = 1000);
+  void release();
+  int64_t timestamp();
+
+private:
+  uint8_t* map;
+  size_t mapLength;
+  FrameBusHeader* header;
+  FrameBusSlot* slots;
+  int client;
+  uint32_t bit;
+  int held;
+  uint64_t lastFrame;
+};
+
+/* create the bus, replacing any left by a daemon that died */
+FrameBusWriter::FrameBusWriter(const std::string& name, int width, int height, int type, int numSlots) {
+  this->name = name;
+  map = NULL;
+  writing = -1;
+  next = 0;
+
+  size_t pageSize = sysconf(_SC_PAGESIZE);
+  size_t slotBytes = (size_t)width * height * CV_ELEM_SIZE(type);
+  slotBytes = (slotBytes + pageSize - 1) / pageSize * pageSize;
+  size_t dataOffset = sizeof(FrameBusHeader) + numSlots*sizeof(FrameBusSlot);
+  dataOffset = (dataOffset + pageSize - 1) / pageSize * pageSize;
+  mapLength = dataOffset + numSlots*slotBytes;
+
+  shm_unlink(name.c_str());
+  int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0666);
+  if(fd < 0) {
+    std::cerr << "COULD NOT CREATE FRAME BUS " << name << std::endl;
+    return;
+  }
+  if(ftruncate(fd, mapLength) < 0) {
+    std::cerr << "COULD NOT SIZE FRAME BUS " << name << std::endl;
+    close(fd);
+    return;
+  }
+
+  void* addr = mmap(NULL, mapLength, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(addr == MAP_FAILED) {
+    std::cerr << "COULD NOT MAP FRAME BUS " << name << std::endl;
+    return;
+  }
+
+  // the new segment is zeroed, which is a valid state for the atomics
+  map = (uint8_t*)addr;
+  header = (FrameBusHeader*)map;
+  slots = (FrameBusSlot*)(map + sizeof(FrameBusHeader));
+  header->width = width;
+  header->height = height;
+  header->type = type;
+  header->numSlots = numSlots;
+  header->slotBytes = slotBytes;
+  header->dataOffset = dataOffset;
+  header->latest.store(-1);
+  memcpy(header->magic, FRAME_BUS_MAGIC, sizeof(header->magic));
+}
+
+FrameBusWriter::~FrameBusWriter() {
+  if(!map) return;
+  munmap(map, mapLength);
+  shm_unlink(name.c_str());
+}
+
+bool FrameBusWriter::isOpen() {
+  return map != NULL;
+}
+
+/* claim a free slot for the next frame and return a header over its
+ * pixels; the frame can be captured straight into it. Empty if every
+ * slot is held by a reader, in which case the frame is dropped.
+ */
+cv::Mat FrameBusWriter::beginFrame() {
+  if(!map) return cv::Mat();
+
+  int latest = header->latest.load();
+  for(int k = 0; k < (int)header->numSlots; k++) {
+    int i = (next + k) % header->numSlots;
+    if(i == latest) continue;
+
+    uint32_t none = 0;
+    if(slots[i].holders.compare_exchange_strong(none, frameBusWriterBit)) {
+      writing = i;
+      next = (i + 1) % header->numSlots;
+      return cv::Mat(header->height, header->width, header->type, map + header->dataOffset + i*header->slotBytes);
+    }
+  }
+
+  return cv::Mat();
+}
+
+/* publish the frame written since beginFrame and wake the readers */
+void FrameBusWriter::commitFrame() {
+  if(writing < 0) return;
+
+  FrameBusSlot& slot = slots[writing];
+  slot.frame = header->published.load() + 1;
+  slot.timestamp = std::chrono::duration_cast<std::chrono::microseconds>(
+                     std::chrono::steady_clock::now().time_since_epoch()).count();
+  slot.holders.fetch_and(~frameBusWriterBit);
+
+  header->latest.store(writing);
+  header->published.fetch_add(1);
+  frameBusFutex(&header->published, FUTEX_WAKE, INT_MAX, NULL);
+  writing = -1;
+}
+
+/* give back the slot claimed by beginFrame without publishing it,
+ * when what was written into it is not a whole frame. Readers only
+ * take the latest published slot, so they never see it.
+ */
+void FrameBusWriter::abortFrame() {
+  if(writing < 0) return;
+
+  slots[writing].holders.fetch_and(~frameBusWriterBit);
+  writing = -1;
+}
+
+/* free the client bits and slots of readers that have exited
+ * without unregistering, returning how many were found
+ */
+int FrameBusWriter::reclaim() {
+  if(!map) return 0;
+
+  int found = 0;
+  for(int c = 0; c < frameBusMaxClients; c++) {
+    int32_t pid = header->clients[c].load();
+    if(pid == 0 || kill(pid, 0) == 0 || errno != ESRCH) continue;
+
+    for(int i = 0; i < (int)header->numSlots; i++) {
+      slots[i].holders.fetch_and(~(1u << c));
+    }
+    header->clients[c].compare_exchange_strong(pid, 0);
+    found++;
+  }
+  return found;
+}
+
+/* map a bus created by capture_daemon and register as a client */
+FrameBusReader::FrameBusReader(const std::string& name) {
+  map = NULL;
+  client = -1;
+  held = -1;
+  lastFrame = 0;
+
+  int fd = shm_open(name.c_str(), O_RDWR, 0);
+  if(fd < 0) {
+    std::cerr << "COULD NOT OPEN FRAME BUS " << name << ", IS capture_daemon RUNNING?" << std::endl;
+    return;
+  }
+
+  struct stat st;
+  if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(FrameBusHeader)) {
+    std::cerr << "FRAME BUS " << name << " IS NOT SET UP" << std::endl;
+    close(fd);
+    return;
+  }
+
+  void* addr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(addr == MAP_FAILED) {
+    std::cerr << "COULD NOT MAP FRAME BUS " << name << std::endl;
+    return;
+  }
+
+  header = (FrameBusHeader*)addr;
+  if(memcmp(header->magic, FRAME_BUS_MAGIC, sizeof(header->magic)) != 0) {
+    std::cerr << name << " IS NOT A FRAME BUS" << std::endl;
+    munmap(addr, st.st_size);
+    return;
+  }
+
+  int32_t pid = getpid();
+  for(int c = 0; c < frameBusMaxClients && client < 0; c++) {
+    int32_t none = 0;
+    if(header->clients[c].compare_exchange_strong(none, pid)) client = c;
+  }
+  if(client < 0) {
+    std::cerr << "FRAME BUS " << name << " HAS NO FREE CLIENTS" << std::endl;
+    munmap(addr, st.st_size);
+    return;
+  }
+
+  map = (uint8_t*)addr;
+  mapLength = st.st_size;
+  slots = (FrameBusSlot*)(map + sizeof(FrameBusHeader));
+  bit = 1u << client;
+}
+
+FrameBusReader::~FrameBusReader() {
+  if(!map) return;
+  release();
+  header->clients[client].store(0);
+  munmap(map, mapLength);
+}
+
+bool FrameBusReader::isOpen() {
+  return map != NULL;
+}
+
+/* let the daemon reuse the slot of the frame last returned */
+void FrameBusReader::release() {
+  if(held < 0) return;
+  slots[held].holders.fetch_and(~bit);
+  held = -1;
+}
+
+/* wait for a frame newer than the last one and hold it until the
+ * next call. The frame is a header over the shared slot, so no
+ * pixels are copied, and must not be used after the next call.
+ */
+bool FrameBusReader::next(cv::Mat& frame, int timeoutMs) {
+  if(!map) return false;
+  release();
+
+  std::chrono::steady_clock::time_point deadline =
+    std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+
+  for(;;) {
+    uint32_t published = header->published.load();
+    int i = header->latest.load();
+
+    if(i >= 0 && slots[i].frame > lastFrame) {
+      // once our bit is set the daemon cannot start on the slot; if it
+      // already has, a newer frame is on its way
+      uint32_t before = slots[i].holders.fetch_or(bit);
+      if(!(before & frameBusWriterBit) && slots[i].frame > lastFrame) {
+        held = i;
+        lastFrame = slots[i].frame;
+        frame = cv::Mat(header->height, header->width, header->type,
+                        map + header->dataOffset + i*header->slotBytes);
+        return true;
+      }
+      slots[i].holders.fetch_and(~bit);
+      if(before & frameBusWriterBit) continue;
+    }
+
+    long left = std::chrono::duration_cast<std::chrono::microseconds>(
+                  deadline - std::chrono::steady_clock::now()).count();
+    if(left <= 0) return false;
+
+    struct timespec timeout;
+    timeout.tv_sec = left / 1000000;
+    timeout.tv_nsec = (left % 1000000) * 1000;
+    frameBusFutex(&header->published, FUTEX_WAIT, published, &timeout);
+  }
+}
+
+/* the capture time of the frame held */
+int64_t FrameBusReader::timestamp() {
+  return (held >= 0)? slots[held].timestamp : 0;
+}
+
+#endif
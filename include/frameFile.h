@@ -0,0 +1,219 @@
+#ifndef FRAME_FILE
+#define FRAME_FILE
+
+/******************************************
+ * frameFile.h
+ *
+ * This file describes the recorded frame
+ * file used to replay flights offline.
+ *
+ * A frame file is a fixed header followed
+ * by fixed-size records, each a 64-bit
+ * capture timestamp (microseconds) and the
+ * raw pixel data of one frame, so any frame
+ * can be addressed directly by its index.
+ ******************************************/
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <string.h>
+#include <stdint.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <limits.h>
+
+#include "opencv2/core/core.hpp"
+
+const char FRAME_FILE_MAGIC[8] = {'Q','F','F','R','A','M','E','1'};
+
+struct FrameFileHeader {
+  char magic[8];
+  uint32_t width;
+  uint32_t height;
+  uint32_t type;
+  uint32_t reserved;
+};
+
+class FrameFileWriter {
+public:
+  FrameFileWriter(const std::string& fileName, int width, int height, int type);
+  ~FrameFileWriter();
+
+  bool isOpen();
+  bool write(const cv::Mat&);
+
+private:
+  int fd;
+  FrameFileHeader header;
+  size_t frameBytes;
+};
+
+class FrameFileReader {
+public:
+  FrameFileReader(const std::string& fileName);
+  ~FrameFileReader();
+
+  bool isOpen();
+  int size();
+  int width();
+  int height();
+  int64_t timestamp(int);
+  cv::Mat frame(int);
+
+private:
+  uint8_t* map;
+  size_t mapLength;
+  size_t recordBytes;
+  int numFrames;
+  FrameFileHeader header;
+};
+
+/* create a frame file, truncating any existing file */
+FrameFileWriter::FrameFileWriter(const std::string& fileName, int width, int height, int type) {
+  memcpy(header.magic, FRAME_FILE_MAGIC, sizeof(header.magic));
+  header.width = width;
+  header.height = height;
+  header.type = type;
+  header.reserved = 0;
+  frameBytes = (size_t)width * height * CV_ELEM_SIZE(type);
+
+  fd = open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0) {
+    std::cerr << "COULD NOT OPEN FRAME FILE " << fileName << std::endl;
+    return;
+  }
+
+  if(::write(fd, &header, sizeof(header)) != sizeof(header)) {
+    std::cerr << "COULD NOT WRITE FRAME FILE HEADER" << std::endl;
+    close(fd);
+    fd = -1;
+  }
+}
+
+FrameFileWriter::~FrameFileWriter() {
+  if(fd >= 0) close(fd);
+}
+
+bool FrameFileWriter::isOpen() {
+  return fd >= 0;
+}
+
+/* append a frame, stamped with the current time */
+bool FrameFileWriter::write(const cv::Mat& img) {
+  if(fd < 0) return false;
+  if(img.cols != (int)header.width || img.rows != (int)header.height || img.type() != (int)header.type) {
+    std::cerr << "Frame does not match frame file format" << std::endl;
+    return false;
+  }
+
+  int64_t stamp = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+
+  // the stamp and the pixels in one call, or a call for every
+  // IOV_MAX rows of a frame that is not continuous
+  size_t rowBytes = header.width * img.elemSize();
+  struct iovec iov[IOV_MAX];
+  int n = 0;
+  size_t bytes = 0;
+  iov[n].iov_base = &stamp;
+  iov[n++].iov_len = sizeof(stamp);
+  bytes += sizeof(stamp);
+
+  int rows = img.isContinuous()? 1 : img.rows;
+  size_t partBytes = img.isContinuous()? rowBytes*img.rows : rowBytes;
+  for(int i = 0; i < rows; i++) {
+    iov[n].iov_base = (void*)img.ptr(i);
+    iov[n++].iov_len = partBytes;
+    bytes += partBytes;
+    if(n == IOV_MAX || i == rows - 1) {
+      if(::writev(fd, iov, n) != (ssize_t)bytes) return false;
+      n = 0;
+      bytes = 0;
+    }
+  }
+
+  return true;
+}
+
+/* map a frame file for random access to its frames */
+FrameFileReader::FrameFileReader(const std::string& fileName) {
+  map = NULL;
+  mapLength = 0;
+  numFrames = 0;
+  recordBytes = 0;
+
+  int fd = open(fileName.c_str(), O_RDONLY);
+  if(fd < 0) {
+    std::cerr << "COULD NOT OPEN FRAME FILE " << fileName << std::endl;
+    return;
+  }
+
+  struct stat st;
+  if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(FrameFileHeader)) {
+    std::cerr << "FRAME FILE " << fileName << " IS TRUNCATED" << std::endl;
+    close(fd);
+    return;
+  }
+
+  void* addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(addr == MAP_FAILED) {
+    std::cerr << "COULD NOT MAP FRAME FILE " << fileName << std::endl;
+    return;
+  }
+
+  memcpy(&header, addr, sizeof(header));
+  if(memcmp(header.magic, FRAME_FILE_MAGIC, sizeof(header.magic)) != 0) {
+    std::cerr << fileName << " IS NOT A FRAME FILE" << std::endl;
+    munmap(addr, st.st_size);
+    return;
+  }
+
+  map = (uint8_t*)addr;
+  mapLength = st.st_size;
+  recordBytes = sizeof(int64_t) + (size_t)header.width * header.height * CV_ELEM_SIZE(header.type);
+  numFrames = (mapLength - sizeof(header)) / recordBytes;
+
+  // frames are read front to back by the batch tools
+  madvise(map, mapLength, MADV_SEQUENTIAL);
+}
+
+FrameFileReader::~FrameFileReader() {
+  if(map) munmap(map, mapLength);
+}
+
+bool FrameFileReader::isOpen() {
+  return map != NULL;
+}
+
+int FrameFileReader::size() {
+  return numFrames;
+}
+
+int FrameFileReader::width() {
+  return header.width;
+}
+
+int FrameFileReader::height() {
+  return header.height;
+}
+
+int64_t FrameFileReader::timestamp(int i) {
+  int64_t stamp;
+  memcpy(&stamp, map + sizeof(header) + i*recordBytes, sizeof(stamp));
+  return stamp;
+}
+
+/* a read-only header over the i-th frame; no pixels are copied */
+cv::Mat FrameFileReader::frame(int i) {
+  uint8_t* data = map + sizeof(header) + i*recordBytes + sizeof(int64_t);
+  return cv::Mat(header.height, header.width, header.type, data);
+}
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+/*
+  Counts timings, or any other non-negative values, in fixed width
+  buckets, so the mean, percentiles and worst case of a long run can
+  be printed without keeping every value. Recording a value does not
+  allocate, so it can be done from the control loop.
+*/
+
+#include <stdint.h>
+#include <vector>
+#include <ostream>
+
+class Histogram
+{
+public:
+    Histogram(int64_t bucket_width, int buckets);
+    void record(int64_t value);
+    void reset();
+    uint64_t count() const;
+    int64_t max() const;
+    double mean() const;
+    int64_t percentile(double p) const;
+    void print(std::ostream& out, const char* name, const char* unit) const;
+private:
+    int64_t bucket_width;
+    // the last bucket holds everything past the others
+    std::vector<uint64_t> counts;
+    uint64_t total;
+    int64_t max_value;
+    double sum;
+};
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+/*
+  Logging that never holds up the thread logging. A record is a fixed
+  size binary struct pushed onto a ring owned by the calling thread;
+  if the ring is full the record is dropped and counted rather than
+  waited for. A background thread empties every ring into the log
+  file and, if asked, prints each record as text on stdout, so a slow
+  console or disk only ever slows that thread.
+
+  The file is LOG_MAGIC followed by the records as written. Records
+  from one thread are in order; records of different threads may be
+  interleaved out of order, and are sorted by time_us when read.
+*/
+
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#define LOG_MAGIC "QLOG0001"
+#define LOG_VALUES 6
+
+enum LogType{
+    // roll, pitch and throttle PWM; flags is 1 while in flight
+    LOG_CONTROL = 1,
+    // x, y (cm), z (m) of the position estimate
+    LOG_POSITION,
+    // flow dx, dy and ground distance of a drained batch, and the sample count
+    LOG_FLOW,
+    // x, y, z, psi, theta, phi of the camera pose
+    LOG_POSE,
+    // time to read a frame from the camera, us
+    LOG_FRAME_READ,
+};
+
+struct LogRecord{
+    uint64_t time_us;
+    uint16_t type;
+    uint16_t thread;
+    uint32_t flags;
+    float values[LOG_VALUES];
+};
+
+bool startLogger(const std::string& fileName, bool console);
+void stopLogger();
+pthread_t loggerThread();
+uint64_t loggerDropped();
+
+bool logRecord(uint16_t type, float a = 0, float b = 0, float c = 0,
+               float d = 0, float e = 0, float f = 0, uint32_t flags = 0);
+
+size_t formatLogRecord(const LogRecord& record, char* buf, size_t size);
+
+#endif
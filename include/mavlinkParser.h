@@ -0,0 +1,133 @@
+#ifndef MAVLINK_PARSER_H
+#define MAVLINK_PARSER_H
+
+/*
+  A MAVLink v1 parser that works on whole buffers instead of one byte
+  at a time. It finds frame starts with memchr, checks the length and
+  CRC of each frame against a table of the messages we know, and hands
+  every complete frame in the buffer to the handler registered for its
+  message id. Payloads are passed as pointers into the buffer, so
+  nothing is copied.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define MAVLINK_STX 0xFE
+#define MAVLINK_HEADER_LEN 6
+#define MAVLINK_CHECKSUM_LEN 2
+#define MAVLINK_MAX_FRAME_LEN (MAVLINK_HEADER_LEN + 255 + MAVLINK_CHECKSUM_LEN)
+
+#define MAVLINK_ID_HEARTBEAT 0
+#define MAVLINK_ID_ATTITUDE 30
+#define MAVLINK_ID_OPTICAL_FLOW 100
+#define MAVLINK_ID_HIGHRES_IMU 105
+#define MAVLINK_ID_OPTICAL_FLOW_RAD 106
+
+struct MavlinkFrame{
+    uint8_t len;
+    uint8_t seq;
+    uint8_t sysid;
+    uint8_t compid;
+    uint8_t msgid;
+    // points into the buffer given to parse
+    const uint8_t* payload;
+};
+
+// the messages we decode, with the time they were read on the steady
+// clock (received_usec) next to the sender's own time stamp
+struct MavlinkOpticalFlow{
+    uint64_t received_usec;
+    uint64_t time_usec;
+    float flow_comp_m_x;
+    float flow_comp_m_y;
+    float ground_distance;
+    int16_t flow_x;
+    int16_t flow_y;
+    uint8_t sensor_id;
+    uint8_t quality;
+};
+
+// flow integrated over integration_time_us, and the rotation of the
+// sensor's gyro over the same time; integrated_x - integrated_xgyro
+// is the flow with the rotation of the vehicle taken out
+struct MavlinkOpticalFlowRad{
+    uint64_t received_usec;
+    uint64_t time_usec;
+    uint32_t integration_time_us;
+    float integrated_x;
+    float integrated_y;
+    float integrated_xgyro;
+    float integrated_ygyro;
+    float integrated_zgyro;
+    uint32_t time_delta_distance_us;
+    float distance;
+    int16_t temperature;
+    uint8_t sensor_id;
+    uint8_t quality;
+};
+
+struct MavlinkHighresImu{
+    uint64_t received_usec;
+    uint64_t time_usec;
+    float xacc, yacc, zacc;
+    float xgyro, ygyro, zgyro;
+    float xmag, ymag, zmag;
+    float abs_pressure;
+    float diff_pressure;
+    float pressure_alt;
+    float temperature;
+    uint16_t fields_updated;
+};
+
+struct MavlinkAttitude{
+    uint64_t received_usec;
+    uint32_t time_boot_ms;
+    float roll, pitch, yaw;
+    float rollspeed, pitchspeed, yawspeed;
+};
+
+typedef void (*MavlinkHandler)(const MavlinkFrame& frame, void* context);
+
+struct MavlinkStats{
+    uint64_t frames;
+    uint64_t crc_errors;
+    uint64_t length_errors;
+    uint64_t unknown;
+    uint64_t skipped_bytes;
+};
+
+class MavlinkParser
+{
+public:
+    MavlinkParser();
+    void setHandler(uint8_t msgid, MavlinkHandler handler, void* context);
+    size_t parse(const uint8_t* data, size_t len);
+    const MavlinkStats& stats() const { return counts; }
+private:
+    MavlinkHandler handlers[256];
+    void* contexts[256];
+    MavlinkStats counts;
+};
+
+uint16_t mavlinkCrc(const uint8_t* data, size_t len, uint16_t crc = 0xFFFF);
+bool mavlinkKnown(uint8_t msgid, uint8_t* len, uint8_t* crc_extra);
+size_t mavlinkEncode(uint8_t msgid, const void* payload, uint8_t len, uint8_t seq,
+                     uint8_t sysid, uint8_t compid, uint8_t* out);
+
+void mavlinkDecode(const MavlinkFrame& frame, MavlinkOpticalFlow& msg);
+void mavlinkDecode(const MavlinkFrame& frame, MavlinkOpticalFlowRad& msg);
+void mavlinkDecode(const MavlinkFrame& frame, MavlinkHighresImu& msg);
+void mavlinkDecode(const MavlinkFrame& frame, MavlinkAttitude& msg);
+
+// payload fields are little endian, as is the vehicle
+template <typename T>
+inline T mavlinkField(const uint8_t* payload, int offset)
+{
+    T value;
+    memcpy(&value, payload + offset, sizeof(T));
+    return value;
+}
+
+#endif
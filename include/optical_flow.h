@@ -4,9 +4,11 @@
 #include <string>
 #include <vector>
 #include <stdint.h>
-#include <mutex>
-#include <queue>
 #include <atomic>
+#include <sys/types.h>
+
+#include "mavlinkParser.h"
+#include "spscRing.h"
 
 struct FlowData{
     float flow_x;
@@ -18,24 +20,82 @@ struct FlowData{
 	FlowData() {}
 };
 
+// the flow of every sample since the last drainFlow, added up
+struct FlowIntegral{
+    float dx;
+    float dy;
+    int samples;
+    // seconds from the last sample of the previous drain to the last of this one
+    float timespan;
+    float ground_distance;
+};
+
+// running totals kept by the sensor thread; the sums are compensated
+// (Kahan) so small flows are not lost against a large total
+struct FlowTotals{
+    double x, x_comp;
+    double y, y_comp;
+    uint64_t count;
+    uint64_t first_usec;
+    uint64_t last_usec;
+    float ground_distance;
+};
+
 class OpticalFlowSensor
 {
 public:
     void loop(std::string device_file);
     bool dataReady();
     FlowData getFlowData();
-	OpticalFlowSensor()
-	{
-		ready.store(false);
-	}
+    uint64_t droppedSamples();
+    bool drainFlow(FlowIntegral& integral);
+
+    // every message of each kind, in order, for fusion
+    bool getFlowMessage(MavlinkOpticalFlow& msg);
+    bool getFlowRad(MavlinkOpticalFlowRad& msg);
+    bool getImu(MavlinkHighresImu& msg);
+    bool getAttitude(MavlinkAttitude& msg);
+    OpticalFlowSensor();
+    int eventFd();
 private:
-	std::atomic<bool> ready;
-	std::mutex data_points_mutex;
+	// filled by the sensor thread, emptied by the control loop; when
+	// the loop falls behind the newest samples are dropped and counted
+	SpscRing<FlowData, 256> data_points;
+
+	// totals is the sensor thread's copy, published to shared_totals
+	// under a seqlock; drained is what the last drainFlow read
+	FlowTotals totals;
+	FlowTotals shared_totals;
+	std::atomic<uint32_t> totals_sequence;
+	FlowTotals drained;
+
+	// one channel per message kind, each filled by its own handler
+	SpscRing<MavlinkOpticalFlow, 64> flow_messages;
+	SpscRing<MavlinkOpticalFlowRad, 64> flow_rad_messages;
+	SpscRing<MavlinkHighresImu, 64> imu_messages;
+	SpscRing<MavlinkAttitude, 64> attitude_messages;
 
-	std::queue<FlowData> data_points;
-	
 	int fd;
+	// signalled after each read that decoded a message
+	int event_fd;
+
+	// bytes read from the port but not yet parsed; a frame cut off at
+	// the end of a read is moved to the front to be finished by the next
+	static const size_t RX_SIZE = 4096;
+	uint8_t rx[RX_SIZE];
+	size_t rx_len;
+
+	MavlinkParser parser;
+	// the steady clock time of the read the frames being parsed came in
+	uint64_t rx_time_usec;
+
+	static void on_optical_flow(const MavlinkFrame& frame, void* context);
+	static void on_optical_flow_rad(const MavlinkFrame& frame, void* context);
+	static void on_highres_imu(const MavlinkFrame& frame, void* context);
+	static void on_attitude(const MavlinkFrame& frame, void* context);
 
+	int open_device(const std::string& device_file);
+	ssize_t fill_buffer();
 	int set_interface_attribs(int fd, int speed, int parity);
 };
 
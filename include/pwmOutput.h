@@ -0,0 +1,61 @@
+#ifndef PWM_OUTPUT_H
+#define PWM_OUTPUT_H
+
+/*
+  Writes the motor and servo PWM values. Each channel's device is
+  opened once and kept open; a value is formatted into a buffer on the
+  stack and written with a single pwrite, and only when it differs
+  from the last one written, so a steady tick costs no system calls.
+  A failed write is retried on the next tick, but only the first
+  failure of a streak is printed; the rest are only counted.
+  A channel may be a regular file instead of a device, to try fly
+  without the hardware; the file then always holds the latest value.
+*/
+
+#include <string>
+#include <stdint.h>
+
+#include "histogram.h"
+
+enum PwmChannel{
+    PWM_THROTTLE = 0,
+    PWM_ROLL,
+    PWM_PITCH,
+    PWM_YAW,
+    PWM_CHANNELS
+};
+
+class PwmOutput
+{
+public:
+    // a path for each channel, empty for a channel not used
+    PwmOutput(const std::string devices[PWM_CHANNELS]);
+    ~PwmOutput();
+    bool isOpen(int channel);
+    void set(int channel, int value);
+    int write();
+    uint64_t writes();
+    uint64_t failures();
+    const Histogram& latency();
+private:
+    struct Channel{
+        std::string device;
+        int fd;
+        // -1 until set, or until first written
+        int value;
+        int written;
+        // a regular file is rewritten from the start and truncated
+        bool regular;
+        // devices that cannot seek take write instead of pwrite
+        bool seekable;
+        // the last write failed; set until one succeeds
+        bool failing;
+    };
+
+    Channel channels[PWM_CHANNELS];
+    uint64_t write_count;
+    uint64_t failure_count;
+    Histogram latency_us;
+};
+
+#endif
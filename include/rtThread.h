@@ -0,0 +1,30 @@
+#ifndef RT_THREAD_H
+#define RT_THREAD_H
+
+/*
+  Scheduling for the threads of fly. Each role (the control loop, the
+  flow sensor reader, camera capture, the vision estimators, logging)
+  gets a policy, a priority and a core from the config. Real-time
+  policies and locked memory need CAP_SYS_NICE and CAP_IPC_LOCK (or
+  root); without them a warning is printed and the thread carries on
+  with normal scheduling, so fly still runs on a development machine.
+*/
+
+#include <string>
+#include <stddef.h>
+#include <pthread.h>
+
+struct ThreadConfig{
+    // other, batch, idle, fifo or rr
+    std::string policy;
+    // 1-99 for fifo and rr, ignored otherwise
+    int priority;
+    // core to pin the thread to, -1 for any
+    int core;
+};
+
+bool applyThreadConfig(pthread_t thread, const ThreadConfig& config, const char* role);
+bool lockMemory();
+void prefaultStack(size_t bytes);
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef SHARED_STATE_H
+#define SHARED_STATE_H
+
+/*
+  Publishes the state of the fly process in a POSIX shared memory
+  segment, so other processes on the vehicle can read it at any
+  rate. The writer never waits and makes no system calls after
+  the segment is opened; readers retry if they catch the state
+  mid-update (a seqlock).
+*/
+
+#include <string>
+#include <stdint.h>
+#include <atomic>
+
+#define SHARED_STATE_NAME "/fly_state"
+
+struct FlyState{
+    // microseconds on the steady clock, and the number of updates
+    uint64_t time_us;
+    uint64_t updates;
+
+    // the pose from the cameras
+    float x, y, z;
+    float psi, theta, phi;
+
+    // the optical flow sensor
+    float flow_x;
+    float flow_y;
+    float ground_distance;
+
+    float setPointX, setPointY, setPointZ;
+    int pwmRoll, pwmPitch, pwmThrottle, pwmYaw;
+    uint8_t inFlight;
+};
+
+struct SharedStateSegment{
+    uint32_t magic;
+    uint32_t size;
+    // odd while the writer is updating state
+    std::atomic<uint32_t> sequence;
+    FlyState state;
+};
+
+class StatePublisher
+{
+public:
+    StatePublisher(const std::string& name = SHARED_STATE_NAME);
+    ~StatePublisher();
+    bool isOpen();
+    void publish(const FlyState& state);
+private:
+    std::string name;
+    SharedStateSegment* segment;
+};
+
+class StateReader
+{
+public:
+    StateReader(const std::string& name = SHARED_STATE_NAME);
+    ~StateReader();
+    bool isOpen();
+    bool read(FlyState& state);
+private:
+    const SharedStateSegment* segment;
+};
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+/*
+  A fixed-size queue between exactly one producer thread and one
+  consumer thread. Neither side takes a lock or waits for the other:
+  push fails and counts an overflow when the ring is full, and pop
+  fails when it is empty. The head and tail live on cache lines of
+  their own so the two threads do not contend for the same line.
+
+  Capacity must be a power of two.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+#define SPSC_CACHE_LINE 64
+
+template <typename T, size_t Capacity>
+class SpscRing
+{
+    static_assert((Capacity & (Capacity - 1)) == 0, "SpscRing capacity must be a power of two");
+public:
+    SpscRing() : head(0), tail(0), overflow_count(0) {}
+
+    // producer only
+    bool push(const T& value)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == Capacity)
+        {
+            overflow_count.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        slots[t & (Capacity - 1)] = value;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer only
+    bool pop(T& value)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return false;
+        value = slots[h & (Capacity - 1)];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // exact from the consumer, a snapshot from anywhere else
+    bool empty() const
+    {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+    size_t size() const
+    {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+    // values dropped because the consumer fell behind
+    uint64_t overflows() const
+    {
+        return overflow_count.load(std::memory_order_relaxed);
+    }
+
+    static size_t capacity() { return Capacity; }
+
+private:
+    // head and tail only grow and are masked to index the slots
+    alignas(SPSC_CACHE_LINE) std::atomic<size_t> head;
+    alignas(SPSC_CACHE_LINE) std::atomic<size_t> tail;
+    alignas(SPSC_CACHE_LINE) std::atomic<uint64_t> overflow_count;
+    alignas(SPSC_CACHE_LINE) T slots[Capacity];
+};
+
+#endif
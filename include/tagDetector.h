@@ -0,0 +1,452 @@
+#ifndef TAG_DETECTOR
+#define TAG_DETECTOR
+
+/******************************************
+ * tagDetector.h
+ *
+ * This file describes the tag detector used
+ * by the vision system. It finds the tags in
+ * a single grayscale frame and holds no state
+ * between frames, so one detector can be
+ * shared by several threads.
+ *
+ * By default the detector works on the raw,
+ * distorted frame and only undistorts the
+ * points it needs (tag corners through a
+ * per-pixel lookup table, grid sample points
+ * by projecting them with the distortion).
+ * The older mode remaps every frame first.
+ * Either way the tag corners it reports are
+ * ideal pinhole image coordinates under
+ * cameraMatrix with no distortion.
+ *
+ * The tables built from the calibration are
+ * cached in config.cacheDir (see
+ * calibrationCache.h).
+ ******************************************/
+
+#include <iostream>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <cfloat>
+
+#include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/calib3d/calib3d.hpp"
+
+#include "SquarePattern.h"
+#include "StoredPatterns.h"
+#include "config.h"
+#include "calibrationCache.h"
+
+using namespace cv;
+
+struct CandidateTag {
+  // undistorted image coordinates of the corners
+  Point2f corner[4];
+  // the corners in the frame given to the detector
+  Point2f imageCorner[4];
+  // corner[i] in the reference frame of the tag
+  Point3f object[4];
+  SquarePattern pattern;
+  Mat r;
+  Mat t;
+  Mat rp;
+  Mat tp;
+};
+
+// a tag of the map predicted to be in view (see predictTags)
+struct ExpectedTag {
+  SquarePattern pattern;
+  // its center in the frame given to the detector
+  Point2f imagePoint;
+};
+
+class TagDetector {
+public:
+  TagDetector(const CameraConfig&, const TagGeometry&, const std::string& cacheDir = "");
+  ~TagDetector();
+
+  void undistort(const Mat&, Mat&);
+  Point2f undistortPoint(Point2f);
+  void findCandidateTags(vector<CandidateTag*>&, Mat&,
+                         const vector<ExpectedTag>& = vector<ExpectedTag>(), int = 0);
+  void predictTags(const Mat&, const Mat&, const vector<SquarePattern>&,
+                   const vector<tagPose>&, vector<ExpectedTag>&);
+
+  Mat cameraMatrix, distCoeffs;
+
+private:
+  // a four sided contour and the contours inside it
+  struct Quad {
+    vector<Point> polygon;
+    vector<vector<Point> > inner;
+    float distance;
+    bool operator<(const Quad& other) const { return distance < other.distance; }
+  };
+
+  void buildTables(vector<Mat>&);
+  CandidateTag* decodeQuad(const vector<Point>&, vector<vector<Point> >&);
+
+  static const int polygonCloseResolution = 1000;//15;
+  float innerSquareLength;
+  Size imageSize;
+  TagGeometry geometry;
+
+  SquarePatternHandle* candidateHandle;
+  CalibrationCache cache;
+
+  // the tables below may point into the mapped cache file
+  bool sparse;
+  Mat distmap1, distmap2;
+  // undistorted position of every pixel of the raw frame
+  Mat undistortLut;
+
+  Mat testPointGrid;
+  Mat testOuterSquare;
+  // the match for every possible pattern, indexed by pattern
+  Mat decodeTable;
+};
+
+// the order of the tables in the cache file
+enum { TABLE_DISTMAP1, TABLE_DISTMAP2, TABLE_LUT, TABLE_GRID, TABLE_OUTER, TABLE_DECODE, NUM_TABLES };
+const int cacheVersion = 1;
+
+TagDetector::TagDetector(const CameraConfig& camera, const TagGeometry& geometry, const std::string& cacheDir) {
+  cameraMatrix = camera.cameraMatrix;
+  distCoeffs = camera.distCoeffs;
+  imageSize = Size(camera.width, camera.height);
+  sparse = camera.sparseUndistort;
+  this->geometry = geometry;
+
+  // add the candidate patterns to the candidate handler
+  candidateHandle = new SquarePatternHandle(3);
+  for(int k = 0 ; k < numPatterns; k++) {
+    candidateHandle->add(storedPatterns[k]);
+  }
+
+  innerSquareLength = gridSize * (geometry.squareSideLength + geometry.gapLength) - geometry.gapLength + 2*geometry.gridBorderOffset;
+
+  // key the cache on everything the tables are built from
+  CacheKey key;
+  key.add(cacheVersion);
+  key.add(imageSize.width);
+  key.add(imageSize.height);
+  key.add(sparse);
+  key.add(cameraMatrix);
+  key.add(distCoeffs);
+  key.add(geometry.squareSideLength);
+  key.add(geometry.gapLength);
+  key.add(geometry.gridBorderOffset);
+  key.add(gridSize);
+  key.add(storedPatterns, sizeof(storedPatterns));
+
+  vector<Mat> tables;
+  std::string cacheFile = CalibrationCache::fileName(cacheDir, key.value());
+  if(cacheDir.empty() || !cache.map(cacheFile, key.value(), tables) || tables.size() != NUM_TABLES) {
+    buildTables(tables);
+    if(!cacheDir.empty()) CalibrationCache::write(cacheFile, key.value(), tables);
+  }
+
+  distmap1 = tables[TABLE_DISTMAP1];
+  distmap2 = tables[TABLE_DISTMAP2];
+  undistortLut = tables[TABLE_LUT];
+  testPointGrid = tables[TABLE_GRID];
+  testOuterSquare = tables[TABLE_OUTER];
+  decodeTable = tables[TABLE_DECODE];
+}
+
+/* build every table derived from the calibration and tag geometry */
+void TagDetector::buildTables(vector<Mat>& tables) {
+  tables.assign(NUM_TABLES, Mat());
+
+  // set up the test points for the pattern grid
+  Mat grid(gridSize*gridSize, 1, CV_32FC3);
+  Point3f cur;
+  for(int i = 0; i < gridSize; i++) {
+    for(int j = 0; j < gridSize; j++) {
+      cur.x = geometry.gridBorderOffset + ((float)i)*geometry.gapLength + ((float)i + 0.5)*geometry.squareSideLength;
+      cur.y = geometry.gridBorderOffset + ((float)j)*geometry.gapLength + ((float)j + 0.5)*geometry.squareSideLength;
+      cur.z = 0;
+      grid.at<Point3f>(i*gridSize + j) = cur;
+    }
+  }
+  tables[TABLE_GRID] = grid;
+
+  // set up the four corner points
+  float side = 2*geometry.gridBorderOffset + (gridSize - 1)*geometry.gapLength + (gridSize)*geometry.squareSideLength;
+  Mat outer(4, 1, CV_32FC3);
+  outer.at<Point3f>(0) = Point3f(0, 0, 0);
+  outer.at<Point3f>(1) = Point3f(side, 0, 0);
+  outer.at<Point3f>(2) = Point3f(side, side, 0);
+  outer.at<Point3f>(3) = Point3f(0, side, 0);
+  tables[TABLE_OUTER] = outer;
+
+  // a pattern is gridSize*gridSize bits, so every pattern fits in a table
+  Mat decode(1 << (gridSize*gridSize), 1, CV_32SC2);
+  for(int p = 0; p < decode.rows; p++) {
+    decode.at<rotation>(p) = candidateHandle->findMatchingPattern(p);
+  }
+  tables[TABLE_DECODE] = decode;
+
+  if(sparse) {
+    // undistort every pixel once, so a corner costs a table lookup
+    Mat pixels(imageSize.area(), 1, CV_32FC2);
+    for(int y = 0; y < imageSize.height; y++) {
+      for(int x = 0; x < imageSize.width; x++) {
+        pixels.at<Point2f>(y*imageSize.width + x) = Point2f(x, y);
+      }
+    }
+    Mat lut;
+    undistortPoints(pixels, lut, cameraMatrix, distCoeffs, noArray(), cameraMatrix);
+    tables[TABLE_LUT] = lut.reshape(2, imageSize.height);
+  }
+  else {
+    // set up the distortion matrices
+    Mat map1(imageSize, CV_16SC2);
+    Mat map2(imageSize, CV_16UC1);
+
+    //initialize the distortion maps
+    initUndistortRectifyMap(cameraMatrix, distCoeffs, Mat_<double>::eye(3,3), cameraMatrix,
+                            imageSize, map1.type(), map1, map2);
+    tables[TABLE_DISTMAP1] = map1;
+    tables[TABLE_DISTMAP2] = map2;
+  }
+}
+
+TagDetector::~TagDetector() {
+  delete candidateHandle;
+}
+
+/* prepare a grayscale frame from the camera for detection;
+ * in the sparse mode the frame is used as it is.
+ */
+void TagDetector::undistort(const Mat& src_gray, Mat& img) {
+  if(sparse) img = src_gray;
+  else       remap(src_gray, img, distmap1, distmap2, INTER_LINEAR, BORDER_CONSTANT );
+}
+
+/* the undistorted position of a point in the raw frame,
+ * interpolated between the four nearest pixels of the table
+ */
+Point2f TagDetector::undistortPoint(Point2f p) {
+  if(!sparse) return p;
+
+  float x = std::min(std::max(p.x, 0.f), (float)(undistortLut.cols - 1));
+  float y = std::min(std::max(p.y, 0.f), (float)(undistortLut.rows - 1));
+  int x0 = std::min((int)x, undistortLut.cols - 2);
+  int y0 = std::min((int)y, undistortLut.rows - 2);
+  float ax = x - x0, ay = y - y0;
+
+  const Point2f* row0 = undistortLut.ptr<Point2f>(y0);
+  const Point2f* row1 = undistortLut.ptr<Point2f>(y0 + 1);
+  return (row0[x0]*(1 - ax) + row0[x0 + 1]*ax)*(1 - ay) +
+         (row1[x0]*(1 - ax) + row1[x0 + 1]*ax)*ay;
+}
+
+/* find and decode the tags in a frame. Quads near where expected
+ * tags should be are decoded first, and the search stops once
+ * `enough` of the expected tags are found (0 to search everything).
+ */
+void TagDetector::findCandidateTags(vector<CandidateTag*>& candidateTags, Mat& img,
+                                    const vector<ExpectedTag>& expected, int enough) {
+  vector<vector<Point> > contours;
+  vector<Vec4i> hierarchy;
+  vector<Quad> quads;
+  Mat thresholded;
+
+  //Use canny to create an edge map
+  Canny(img, thresholded, 50, 100, 3);
+
+  //find the contours in the edgemap  *******THIS MIGHT BE ABLE TO BE OPTIMIZED********
+  findContours(thresholded, contours, hierarchy, CV_RETR_TREE, CV_CHAIN_APPROX_NONE, Point(0,0));
+
+  //find the quadrilaterals in the contours
+  for(int i = 0; i < contours.size(); i++) {
+    if(/*hierarchy[i][2] >= 0  &&*/
+       sqrt((contours[i][0].x - contours[i][contours[i].size() - 1].x)*
+       (contours[i][0].x - contours[i][contours[i].size() - 1].x) +
+       (contours[i][0].y - contours[i][contours[i].size() - 1].y)*
+       (contours[i][0].y - contours[i][contours[i].size() - 1].y)) < polygonCloseResolution
+       ){
+
+      Quad quad;
+
+      //fits a polygon to the contour
+      approxPolyDP(contours[i], quad.polygon, 10, true);
+
+      //if the fit polygon is four sided
+      if(quad.polygon.size() == 4){
+
+        //add its inner contours to the quad
+        int nextcont = hierarchy[i][2];
+        while(nextcont >= 0){
+          vector<Point> innerpolygons;
+          approxPolyDP(contours[nextcont], innerpolygons, 10, true);
+
+          //if the polygon has at least 4 'children'
+          if(innerpolygons.size() >= 4) {
+            quad.inner.push_back(innerpolygons);
+          }
+          nextcont = hierarchy[nextcont][0];
+        }
+
+        if(quad.inner.size() < 2) continue;
+
+        // the squared distance to the closest expected tag
+        Point2f center = (Point2f(quad.polygon[0]) + Point2f(quad.polygon[1]) +
+                          Point2f(quad.polygon[2]) + Point2f(quad.polygon[3]))*0.25f;
+        quad.distance = expected.empty()? 0.f : FLT_MAX;
+        for(int e = 0; e < expected.size(); e++) {
+          Point2f d = expected[e].imagePoint - center;
+          quad.distance = std::min(quad.distance, d.dot(d));
+        }
+
+        quads.push_back(quad);
+      }
+    }
+  }
+
+  std::stable_sort(quads.begin(), quads.end());
+
+  int found = 0;
+  for(int i = 0; i < quads.size(); i++) {
+    CandidateTag* newTag = decodeQuad(quads[i].polygon, quads[i].inner);
+    if(newTag == NULL) continue;
+    candidateTags.push_back(newTag);
+
+    for(int e = 0; e < expected.size(); e++) {
+      if(expected[e].pattern == newTag->pattern) found++;
+    }
+    if(enough > 0 && found >= enough) break;
+  }
+}
+
+/* sample the pattern inside a quad and decode it, returning
+ * NULL when it is not one of the stored patterns
+ */
+CandidateTag* TagDetector::decodeQuad(const vector<Point>& polygons, vector<vector<Point> >& innerContours) {
+  //construct the pattern in the quad
+  CandidateTag* newTag = new CandidateTag;
+  newTag->pattern = NULL_PATTERN;
+
+  vector<Point2f> imagePoints;
+  vector<Point2f> squareVector;
+  Point2f cur;
+
+  for(int z = 0; z < 4; z++) {
+    newTag->imageCorner[z] = Point2f(polygons[z].x, polygons[z].y);
+    cur = undistortPoint(newTag->imageCorner[z]);
+    squareVector.push_back(cur);
+
+    newTag->corner[z] = cur;
+  }
+
+  // the corners are undistorted already; the sample points must land
+  // on the contours, which are distorted only in the sparse mode
+  solvePnP(testOuterSquare, squareVector, cameraMatrix, Mat(), newTag->r, newTag->t, false, CV_ITERATIVE);
+  projectPoints(testPointGrid, newTag->r, newTag->t, cameraMatrix, sparse? distCoeffs : Mat(), imagePoints);
+
+  for(int z = 0; z < imagePoints.size(); z++) {
+    for(vector< vector<Point> >::iterator m = innerContours.begin(); m != innerContours.end(); ++m) {
+      if(pointPolygonTest(*m, imagePoints[z], false) >= 0) {
+        candidateHandle->set(newTag->pattern, int(z/gridSize), z%gridSize, true);
+        vector< vector<Point> >::iterator n = m;
+        --m;
+        innerContours.erase(n);
+        break;
+      }
+    }
+  }
+
+  rotation temprot = decodeTable.ptr<rotation>()[newTag->pattern];
+  if(temprot.pattern != NULL_PATTERN) {
+    newTag->pattern = temprot.pattern;
+
+    tagPose tempPose;
+    double a = temprot.angle;
+
+    Mat r0 = (Mat_<double>(gridSize, 1) << 0., 0., temprot.angle*M_PI_2);
+    Mat t0 = (Mat_<double>(gridSize, 1) << ((a == 1 || a == 2)?
+                                             innerSquareLength : 0.),
+                                           ((a == 2 || a == 3)?
+                                             -innerSquareLength : 0.),
+                                           0.);
+
+    Mat temp;
+
+    // r0 and t0 take a point on the tag into the pattern
+    // used in solvePnP, so the inverse places the corners
+    // found above on the tag itself.
+    Rodrigues(r0, temp);
+    for(int z = 0; z < 4; z++) {
+      Point3f q = testOuterSquare.at<Point3f>(z);
+      Mat p = (Mat_<double>(3,1) << q.x, q.y, q.z);
+      p = temp.t()*(p - t0);
+      newTag->object[z] = Point3f(p.at<double>(0), p.at<double>(1), p.at<double>(2));
+    }
+
+    // r0 and t0 transform from the coordinate system of the
+    // known tag to the coordinate system of the pattern
+    // used in solvePnP.
+
+    // r and t transform from the reference frame of the pattern
+    // used in solvePnP to the reference frame of the camera
+
+    // this composition transforms from the tag reference
+    // frame to the camera reference frame
+
+    composeRT(r0, t0, newTag->r, newTag->t, r0, t0);
+
+    // inverting the above transformation gives a transformation
+    // from the coordinate system of the camera to the reference
+    // frame of the tag.
+    Rodrigues(r0, temp);
+    transpose(temp, temp);
+    tempPose.t = -temp*t0;
+    Rodrigues(temp, tempPose.r_vec);
+
+    newTag->tp = tempPose.t;
+    newTag->rp = tempPose.r_vec;
+    return newTag;
+  }
+
+  delete newTag;
+  return NULL;
+}
+
+/* the tags of the map in view of a predicted camera pose, with
+ * where their centers should appear in the frame given to the
+ * detector. rw (a rotation vector) and tw take points from the
+ * world to the camera.
+ */
+void TagDetector::predictTags(const Mat& rw, const Mat& tw, const vector<SquarePattern>& patterns,
+                              const vector<tagPose>& poses, vector<ExpectedTag>& expected) {
+  float side = testOuterSquare.at<Point3f>(2).x;
+  Mat center = (Mat_<double>(3,1) << side/2, side/2, 0.);
+  Size margin(imageSize.width/4, imageSize.height/4);
+
+  for(int i = 0; i < patterns.size(); i++) {
+    // tag to world, then world to camera
+    Mat r, t, R;
+    composeRT(poses[i].r_vec, poses[i].t, rw, tw, r, t);
+    Rodrigues(r, R);
+    Mat p = R*center + t;
+    if(p.at<double>(2) <= 0) continue;
+
+    vector<Point3f> object(1, Point3f(p.at<double>(0), p.at<double>(1), p.at<double>(2)));
+    vector<Point2f> image;
+    projectPoints(object, Mat::zeros(3, 1, CV_64F), Mat::zeros(3, 1, CV_64F),
+                  cameraMatrix, sparse? distCoeffs : Mat(), image);
+    // the pose is a frame old, so allow for tags moving into view
+    if(image[0].x < -margin.width || image[0].y < -margin.height ||
+       image[0].x >= imageSize.width + margin.width || image[0].y >= imageSize.height + margin.height) continue;
+
+    ExpectedTag tag;
+    tag.pattern = patterns[i];
+    tag.imagePoint = image[0];
+    expected.push_back(tag);
+  }
+}
+
+#endif
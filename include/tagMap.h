@@ -0,0 +1,274 @@
+#ifndef TAG_MAP
+#define TAG_MAP
+
+/******************************************
+ * tagMap.h
+ *
+ * This file describes the map of known tags
+ * shared by every camera on the vehicle.
+ *
+ * Each camera looks up the tags it sees many
+ * times a frame but adds a tag only when it
+ * first comes into view, so the map is kept
+ * as an immutable snapshot that readers pick
+ * up with a single atomic load and never
+ * wait on. An addition copies the snapshot,
+ * changes the copy and publishes it as the
+ * next version; the old one is freed once no
+ * reader can still be using it.
+ *
+ * Each reader thread announces the epoch it
+ * started reading in, in a slot of its own.
+ * A snapshot replaced in epoch E is freed
+ * once every slot is idle or has reached E.
+ *
+ * The tags are also filed in a uniform grid
+ * over the ground plane by their position,
+ * so the tags near the camera are found in
+ * the same time however large the map grows.
+ ******************************************/
+
+#include <iostream>
+#include <string>
+#include <map>
+#include <vector>
+#include <cmath>
+#include <atomic>
+#include <mutex>
+
+#include "SquarePattern.h"
+#include "StoredPatterns.h"
+
+class TagMap {
+public:
+  TagMap(float cellSize = 50);
+  ~TagMap();
+
+  bool find(SquarePattern, tagPose&);
+  bool add(SquarePattern, const tagPose&);
+  void findNear(const Point3f&, float, vector<SquarePattern>&, vector<tagPose>&);
+  int size();
+  unsigned version();
+
+  bool load(const std::string&);
+  bool save(const std::string&);
+
+private:
+  typedef std::pair<int, int> Cell;
+
+  struct Snapshot {
+    unsigned version;
+    // only ever searched once published
+    mutable SquarePatternHandle handle;
+    std::map<SquarePattern, tagPose> poses;
+    // the tags in each cell of the grid, by cell (x, y)
+    std::map<Cell, vector<SquarePattern> > cells;
+
+    Snapshot() : handle(gridSize) { }
+  };
+
+  struct Retired {
+    const Snapshot* snapshot;
+    unsigned long epoch;
+  };
+
+  const Snapshot* beginRead(int&);
+  void endRead(int);
+  int readerSlot();
+  void publish(Snapshot*);
+  bool insert(Snapshot*, SquarePattern, const tagPose&);
+
+  Cell cellOf(float x, float y);
+  float cellSize;
+
+  std::atomic<const Snapshot*> current;
+  std::atomic<unsigned long> epoch;
+
+  // the epoch each reader started in, 0 when not reading
+  static const int maxReaders = 32;
+  std::atomic<unsigned long> readers[maxReaders];
+  std::atomic<int> numReaders;
+
+  // held by writers, and by readers beyond maxReaders
+  std::mutex writeLock;
+  vector<Retired> retired;
+};
+
+TagMap::TagMap(float cellSize) {
+  this->cellSize = cellSize;
+  epoch = 1;
+  numReaders = 0;
+  for(int i = 0; i < maxReaders; i++) readers[i] = 0;
+
+  Snapshot* empty = new Snapshot;
+  empty->version = 0;
+  current = empty;
+}
+
+TagMap::~TagMap() {
+  for(int i = 0; i < retired.size(); i++) delete retired[i].snapshot;
+  delete current.load();
+}
+
+/* the slot of the calling thread, claimed on its first read */
+int TagMap::readerSlot() {
+  static thread_local std::map<TagMap*, int> slots;
+  std::map<TagMap*, int>::iterator slot = slots.find(this);
+  if(slot != slots.end()) return slot->second;
+
+  int index = numReaders++;
+  if(index >= maxReaders) {
+    std::cerr << "TOO MANY TAG MAP READERS, FALLING BACK TO THE WRITE LOCK" << std::endl;
+    index = -1;
+  }
+  slots[this] = index;
+  return index;
+}
+
+const TagMap::Snapshot* TagMap::beginRead(int& slot) {
+  slot = readerSlot();
+  if(slot < 0) writeLock.lock();
+  else         readers[slot].store(epoch.load());
+  return current.load();
+}
+
+void TagMap::endRead(int slot) {
+  if(slot < 0) writeLock.unlock();
+  else         readers[slot].store(0);
+}
+
+/* replace the snapshot with a new version and free the old
+ * versions no reader can still hold. Called with writeLock held.
+ */
+void TagMap::publish(Snapshot* next) {
+  const Snapshot* old = current.load();
+  next->version = old->version + 1;
+  current.store(next);
+
+  // a reader announcing this epoch or later loads the new snapshot
+  Retired r;
+  r.snapshot = old;
+  r.epoch = ++epoch;
+  retired.push_back(r);
+
+  unsigned long oldest = r.epoch;
+  for(int i = 0; i < maxReaders; i++) {
+    unsigned long e = readers[i].load();
+    if(e != 0 && e < oldest) oldest = e;
+  }
+
+  vector<Retired> kept;
+  for(int i = 0; i < retired.size(); i++) {
+    if(retired[i].epoch <= oldest) delete retired[i].snapshot;
+    else                           kept.push_back(retired[i]);
+  }
+  retired.swap(kept);
+}
+
+/* add a tag to a snapshot that is not yet published */
+bool TagMap::insert(Snapshot* snapshot, SquarePattern pattern, const tagPose& pose) {
+  if(snapshot->handle.findMatchingPattern(pattern).pattern != NULL_PATTERN) return false;
+
+  snapshot->handle.add(pattern);
+  snapshot->poses[pattern] = pose;
+  snapshot->cells[cellOf(pose.t.at<double>(0), pose.t.at<double>(1))].push_back(pattern);
+  return true;
+}
+
+/* look up the pose of a tag in any of its rotations. The pose
+ * returned shares its data with the map; it is never changed
+ * once added, so it stays valid after the snapshot is freed.
+ */
+bool TagMap::find(SquarePattern pattern, tagPose& pose) {
+  int slot;
+  const Snapshot* snapshot = beginRead(slot);
+  rotation rot = snapshot->handle.findMatchingPattern(pattern);
+  bool found = rot.pattern != NULL_PATTERN;
+  if(found) pose = snapshot->poses.find(rot.pattern)->second;
+  endRead(slot);
+  return found;
+}
+
+/* add a tag to the map. Two cameras may both register a tag they
+ * see for the first time; the first pose added is kept.
+ */
+bool TagMap::add(SquarePattern pattern, const tagPose& pose) {
+  std::lock_guard<std::mutex> guard(writeLock);
+  Snapshot* next = new Snapshot(*current.load());
+  if(!insert(next, pattern, pose)) {
+    delete next;
+    return false;
+  }
+
+  publish(next);
+  return true;
+}
+
+TagMap::Cell TagMap::cellOf(float x, float y) {
+  return Cell((int)std::floor(x/cellSize), (int)std::floor(y/cellSize));
+}
+
+/* the tags within about radius of a point on the ground plane; the
+ * cells overlapping the circle are searched, so a few more may be
+ * returned but none that are closer are missed
+ */
+void TagMap::findNear(const Point3f& position, float radius,
+                      vector<SquarePattern>& patterns, vector<tagPose>& found) {
+  Cell low = cellOf(position.x - radius, position.y - radius);
+  Cell high = cellOf(position.x + radius, position.y + radius);
+
+  int slot;
+  const Snapshot* snapshot = beginRead(slot);
+  for(int x = low.first; x <= high.first; x++) {
+    for(int y = low.second; y <= high.second; y++) {
+      std::map<Cell, vector<SquarePattern> >::const_iterator cell = snapshot->cells.find(Cell(x, y));
+      if(cell == snapshot->cells.end()) continue;
+      for(int i = 0; i < cell->second.size(); i++) {
+        patterns.push_back(cell->second[i]);
+        found.push_back(snapshot->poses.find(cell->second[i])->second);
+      }
+    }
+  }
+  endRead(slot);
+}
+
+int TagMap::size() {
+  int slot;
+  const Snapshot* snapshot = beginRead(slot);
+  int n = snapshot->poses.size();
+  endRead(slot);
+  return n;
+}
+
+/* the number of changes made to the map */
+unsigned TagMap::version() {
+  int slot;
+  unsigned v = beginRead(slot)->version;
+  endRead(slot);
+  return v;
+}
+
+/* add every tag in a tag map file as one new version */
+bool TagMap::load(const std::string& fileName) {
+  std::map<SquarePattern, tagPose> loaded;
+  if(!readTagMap(fileName, loaded)) return false;
+
+  std::lock_guard<std::mutex> guard(writeLock);
+  Snapshot* next = new Snapshot(*current.load());
+  for(std::map<SquarePattern, tagPose>::iterator i = loaded.begin(); i != loaded.end(); ++i) {
+    insert(next, i->first, i->second);
+  }
+  publish(next);
+  return true;
+}
+
+/* write every tag to a tag map file */
+bool TagMap::save(const std::string& fileName) {
+  int slot;
+  const Snapshot* snapshot = beginRead(slot);
+  std::map<SquarePattern, tagPose> copy = snapshot->poses;
+  endRead(slot);
+  return writeTagMap(fileName, copy);
+}
+
+#endif
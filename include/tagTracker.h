@@ -0,0 +1,186 @@
+#ifndef TAG_TRACKER
+#define TAG_TRACKER
+
+/******************************************
+ * tagTracker.h
+ *
+ * This file describes the tracker that
+ * follows the corners of the tags found by
+ * a full detection from frame to frame with
+ * pyramidal Lucas-Kanade optical flow.
+ *
+ * A tracked tag keeps the pattern it was
+ * decoded as, so a tracked frame needs no
+ * edge map, contour search or decoding; its
+ * corners go straight to solvePnP. A tag is
+ * dropped when its corners do not track back
+ * to where they came from or its quad stops
+ * looking like a tag, and the caller runs a
+ * full detection whenever track() fails.
+ ******************************************/
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/video/tracking.hpp"
+#include "opencv2/calib3d/calib3d.hpp"
+
+#include "config.h"
+#include "tagDetector.h"
+
+using namespace cv;
+
+class TagTracker {
+public:
+  TagTracker(TagDetector*, const TrackerConfig&);
+
+  void reset(const Mat&, const vector<CandidateTag*>&);
+  void clear();
+  bool track(const Mat&, vector<CandidateTag*>&);
+
+private:
+  struct TrackedTag {
+    SquarePattern pattern;
+    Point2f imageCorner[4];
+    Point3f object[4];
+    // transformation from the tag to the camera
+    Mat r;
+    Mat t;
+  };
+
+  bool plausibleQuad(const Point2f*, const Point2f*);
+
+  TagDetector* detector;
+  TrackerConfig config;
+
+  static const int pyramidLevels = 3;
+  Size window;
+
+  vector<TrackedTag> tracked;
+  vector<Mat> prevPyramid;
+  int framesTracked;
+};
+
+TagTracker::TagTracker(TagDetector* detector, const TrackerConfig& config) {
+  this->detector = detector;
+  this->config = config;
+  window = Size(21, 21);
+  framesTracked = 0;
+}
+
+/* start tracking the tags of a full detection in the given frame */
+void TagTracker::reset(const Mat& img, const vector<CandidateTag*>& tags) {
+  tracked.clear();
+  framesTracked = 0;
+  if(!config.enabled) return;
+
+  for(int i = 0; i < tags.size(); i++) {
+    TrackedTag tag;
+    tag.pattern = tags[i]->pattern;
+    for(int z = 0; z < 4; z++) {
+      tag.imageCorner[z] = tags[i]->imageCorner[z];
+      tag.object[z] = tags[i]->object[z];
+    }
+
+    // rp and tp go from the camera to the tag
+    Mat R;
+    Rodrigues(tags[i]->rp, R);
+    R = R.t();
+    tag.t = -R*tags[i]->tp;
+    Rodrigues(R, tag.r);
+
+    tracked.push_back(tag);
+  }
+
+  buildOpticalFlowPyramid(img, prevPyramid, window, pyramidLevels);
+}
+
+void TagTracker::clear() {
+  tracked.clear();
+}
+
+/* a tracked quad must stay convex, keep a sensible size
+ * and not change its area too much in one frame
+ */
+bool TagTracker::plausibleQuad(const Point2f* before, const Point2f* after) {
+  vector<Point2f> quad(after, after + 4);
+  if(!isContourConvex(quad)) return false;
+
+  for(int z = 0; z < 4; z++) {
+    Point2f side = after[(z + 1) % 4] - after[z];
+    if(side.dot(side) < config.minSideLength*config.minSideLength) return false;
+  }
+
+  vector<Point2f> prevQuad(before, before + 4);
+  double ratio = contourArea(quad) / std::max(contourArea(prevQuad), 1.);
+  return ratio > 1./config.maxAreaChange && ratio < config.maxAreaChange;
+}
+
+/* track the tags into a new frame, returning them as candidate tags
+ * ready for filterTags. Fails when a full detection is due instead.
+ */
+bool TagTracker::track(const Mat& img, vector<CandidateTag*>& candidateTags) {
+  if(tracked.empty() || ++framesTracked > config.redetectInterval) return false;
+
+  vector<Mat> pyramid;
+  buildOpticalFlowPyramid(img, pyramid, window, pyramidLevels);
+
+  vector<Point2f> prevPoints, nextPoints, backPoints;
+  for(int i = 0; i < tracked.size(); i++) {
+    prevPoints.insert(prevPoints.end(), tracked[i].imageCorner, tracked[i].imageCorner + 4);
+  }
+
+  vector<uchar> status, backStatus;
+  vector<float> error;
+  calcOpticalFlowPyrLK(prevPyramid, pyramid, prevPoints, nextPoints, status, error, window, pyramidLevels);
+  calcOpticalFlowPyrLK(pyramid, prevPyramid, nextPoints, backPoints, backStatus, error, window, pyramidLevels);
+
+  vector<TrackedTag> survivors;
+  for(int i = 0; i < tracked.size(); i++) {
+    bool good = true;
+    for(int z = 4*i; good && z < 4*i + 4; z++) {
+      Point2f d = backPoints[z] - prevPoints[z];
+      good = status[z] && backStatus[z] &&
+             d.dot(d) < config.maxForwardBackwardError*config.maxForwardBackwardError;
+    }
+    if(!good || !plausibleQuad(&prevPoints[4*i], &nextPoints[4*i])) continue;
+
+    TrackedTag tag = tracked[i];
+    vector<Point2f> corners;
+    for(int z = 0; z < 4; z++) {
+      tag.imageCorner[z] = nextPoints[4*i + z];
+      corners.push_back(detector->undistortPoint(tag.imageCorner[z]));
+    }
+
+    vector<Point3f> object(tag.object, tag.object + 4);
+    solvePnP(object, corners, detector->cameraMatrix, Mat(), tag.r, tag.t, true, CV_ITERATIVE);
+
+    CandidateTag* newTag = new CandidateTag;
+    newTag->pattern = tag.pattern;
+    for(int z = 0; z < 4; z++) {
+      newTag->corner[z] = corners[z];
+      newTag->imageCorner[z] = tag.imageCorner[z];
+      newTag->object[z] = tag.object[z];
+    }
+    newTag->r = tag.r.clone();
+    newTag->t = tag.t.clone();
+
+    // invert to go from the camera to the tag, as the detector does
+    Mat R;
+    Rodrigues(tag.r, R);
+    R = R.t();
+    newTag->tp = -R*tag.t;
+    Rodrigues(R, newTag->rp);
+
+    candidateTags.push_back(newTag);
+    survivors.push_back(tag);
+  }
+
+  tracked.swap(survivors);
+  prevPyramid.swap(pyramid);
+  return !tracked.empty();
+}
+
+#endif
@@ -1,5 +1,13 @@
 #include <fstream>
 #include <string>
+#include <iostream>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#include "GPIO.h"
 
 void initGPIO(int gpioNum, bool direction)
 {
@@ -7,7 +15,7 @@ void initGPIO(int gpioNum, bool direction)
 	export_ofs << std::to_string(gpioNum);
 	export_ofs.close();
 	
-	std::string gpio_direction_file = std::string("/sys/class/gpio") + std::to_string(gpioNum) + std::string("/direction");
+	std::string gpio_direction_file = std::string("/sys/class/gpio/gpio") + std::to_string(gpioNum) + std::string("/direction");
 	
 	std::ofstream direction_ofs(gpio_direction_file);
 	direction_ofs << (direction ? "in" : "out") << std::endl;
@@ -18,7 +26,7 @@ char readGPIO(int gpioNum)
 {
 	char return_val;
 
-	std::string filename = std::string("/sys/class/gpio") + std::to_string(gpioNum) + std::string("/value");
+	std::string filename = std::string("/sys/class/gpio/gpio") + std::to_string(gpioNum) + std::string("/value");
 
 	std::ifstream value_ifs(filename);
 	value_ifs >> return_val;
@@ -26,3 +34,77 @@ char readGPIO(int gpioNum)
 	
 	return return_val;
 }
+
+// export the pin if it is not already, set its direction and keep its value open
+GPIO::GPIO(int gpioNum, bool input, const std::string& root)
+{
+	this->gpioNum = gpioNum;
+	dir = root + "/gpio" + std::to_string(gpioNum);
+	valueFd = -1;
+
+	if (access(dir.c_str(), F_OK) != 0)
+	{
+		std::ofstream export_ofs(root + "/export");
+		export_ofs << gpioNum;
+	}
+
+	std::ofstream direction_ofs(dir + "/direction");
+	direction_ofs << (input ? "in" : "out") << std::endl;
+	direction_ofs.close();
+
+	valueFd = open((dir + "/value").c_str(), (input ? O_RDONLY : O_RDWR) | O_CLOEXEC);
+	if (valueFd < 0)
+		std::cerr << "COULD NOT OPEN GPIO " << gpioNum << ": " << strerror(errno) << std::endl;
+}
+
+GPIO::~GPIO()
+{
+	if (valueFd >= 0) close(valueFd);
+}
+
+bool GPIO::isOpen()
+{
+	return valueFd >= 0;
+}
+
+// the open value file, for poll or epoll with POLLPRI once an edge is set
+int GPIO::fd()
+{
+	return valueFd;
+}
+
+// '0' or '1', or 0 if the pin could not be read. Reading also clears
+// a pending edge.
+char GPIO::read()
+{
+	char value;
+	if (valueFd < 0 || pread(valueFd, &value, 1, 0) != 1)
+		return 0;
+	return value;
+}
+
+// none, rising, falling or both
+bool GPIO::setEdge(const std::string& edge)
+{
+	std::ofstream edge_ofs(dir + "/edge");
+	edge_ofs << edge << std::endl;
+	if (!edge_ofs)
+	{
+		std::cerr << "COULD NOT SET EDGE " << edge << " ON GPIO " << gpioNum << std::endl;
+		return false;
+	}
+	read();
+	return true;
+}
+
+// wait for an edge, returning false on a timeout; a negative timeout waits forever
+bool GPIO::waitForEdge(int timeoutMs)
+{
+	struct pollfd pfd;
+	pfd.fd = valueFd;
+	pfd.events = POLLPRI | POLLERR;
+	if (poll(&pfd, 1, timeoutMs) <= 0)
+		return false;
+	read();
+	return true;
+}
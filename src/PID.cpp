@@ -12,6 +12,7 @@ PID::PID() : P(1), I(1)
 	//std::cout << "init previous time" << std::endl;
 	previousPIDTime = currentTime;
 	pwmOut=15000;
+	sampleTime=0;
 }
 
 void PID::setPwmOut(int pwmOut){
@@ -30,6 +31,12 @@ void PID::setWindupGuard(float windupGuard){
 	this->windupGuard=windupGuard;
 }
 
+// update at a known rate instead of timing each call; the step is kept
+// in the units updatePID has always used, tenths of a second
+void PID::setSampleTime(float seconds){
+	this->sampleTime=seconds*10;
+}
+
 int PID::getPwmOut(){
 	return pwmOut;
 }
@@ -40,6 +47,7 @@ float PID::updatePID(float targetPosition, float currentPosition, bool inFlight)
 	//std::chrono::time_point deltaPIDTime = (currentTime - previousPIDTime);
 	
 	float deltaPIDTime=(std::chrono::duration_cast<std::chrono::microseconds>(currentTime-previousPIDTime).count())/100000.0;
+	if(sampleTime > 0) deltaPIDTime=sampleTime;
 	
 	//std::cout<<deltaPIDTime<<std::endl;
 
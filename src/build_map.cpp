@@ -0,0 +1,79 @@
+/******************************************
+ * build_map.cpp
+ *
+ * Builds an optimized tag map from a frame
+ * file recorded with `fly -r`.
+ *
+ * usage: build_map <frames> <tag map> [stride] [threads] [config]
+ *
+ * Every stride-th frame is run through the
+ * tag detector on all cores, then the tags
+ * seen are bundle adjusted into a map that
+ * `fly -m` loads at startup.
+ ******************************************/
+
+#include <iostream>
+#include <chrono>
+#include <stdlib.h>
+
+#include "config.h"
+#include "frameFile.h"
+#include "tagDetector.h"
+#include "batchDetector.h"
+#include "bundleAdjuster.h"
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        std::cerr << "usage: " << argv[0] << " <frames> <tag map> [stride] [threads] [config]" << std::endl;
+        return 1;
+    }
+
+    int stride = (argc > 3)? atoi(argv[3]) : 1;
+    int threads = (argc > 4)? atoi(argv[4]) : 0;
+
+    FlyConfig config;
+    loadConfig((argc > 5)? argv[5] : "config/fly.yml", config);
+
+    FrameFileReader frames(argv[1]);
+    if (!frames.isOpen())
+        return 1;
+
+    // the calibration the frames were recorded with
+    config.camera.width = frames.width();
+    config.camera.height = frames.height();
+    TagDetector detector(config.camera, config.tag, config.cacheDir);
+
+    auto start = std::chrono::steady_clock::now();
+
+    vector< vector<TagObservation> > observations;
+    detectFrames(frames, detector, observations, stride, threads);
+
+    auto detected = std::chrono::steady_clock::now();
+    std::cerr << "detected tags in " << observations.size() << " frames in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(detected - start).count()
+              << " ms" << std::endl;
+
+    BundleAdjuster adjuster(config.camera.cameraMatrix);
+    for (int i = 0; i < observations.size(); i++)
+        adjuster.addFrame(observations[i]);
+
+    int numTags = adjuster.initialize(INITIAL_PATTERN);
+    std::cerr << numTags << " tags located in " << adjuster.numFrames() << " frames" << std::endl;
+    if (numTags < 2)
+    {
+        std::cerr << "the initial tag was never seen with another tag" << std::endl;
+        return 1;
+    }
+
+    double rms = adjuster.optimize();
+    std::cerr << "final RMS reprojection error " << rms << " px in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(
+                     std::chrono::steady_clock::now() - detected).count()
+              << " ms" << std::endl;
+
+    std::map<SquarePattern, tagPose> poses;
+    adjuster.getTagPoses(poses);
+    return writeTagMap(argv[2], poses)? 0 : 1;
+}
@@ -0,0 +1,171 @@
+/******************************************
+ * calibrate.cpp
+ *
+ * Calibrates the camera from a frame file
+ * of tag views recorded with `fly -r` and
+ * writes the result into a config file.
+ *
+ * usage: calibrate <frames> <config out> [config in] [tag map] [stride]
+ *
+ * The tag corners of every stride-th frame
+ * are found on all cores and refined to
+ * sub-pixel accuracy. With a tag map (from
+ * build_map) each frame is one view of all
+ * of its mapped tags; without one, each tag
+ * is a view on its own. The calibration in
+ * [config in] is the starting guess and is
+ * needed to decode the tags, so detection
+ * is run again with the new calibration
+ * until it settles.
+ ******************************************/
+
+#include <iostream>
+#include <chrono>
+#include <map>
+#include <algorithm>
+#include <stdlib.h>
+
+#include "opencv2/calib3d/calib3d.hpp"
+
+#include "config.h"
+#include "frameFile.h"
+#include "tagDetector.h"
+#include "batchDetector.h"
+
+// calibrateCamera solves for every view's pose at once,
+// so its cost grows quickly with the number of views
+const int maxViews = 80;
+const int rounds = 3;
+
+/* the corners of a tag placed in the world by the tag map */
+void worldCorners(const TagObservation& obs, const tagPose& pose, vector<Point3f>& corners)
+{
+    Mat R;
+    Rodrigues(pose.r_vec, R);
+    for (int z = 0; z < 4; z++)
+    {
+        Mat p = (Mat_<double>(3,1) << obs.object[z].x, obs.object[z].y, obs.object[z].z);
+        p = R*p + pose.t;
+        corners.push_back(Point3f(p.at<double>(0), p.at<double>(1), p.at<double>(2)));
+    }
+}
+
+/* group the observations into calibration views, keeping
+ * at most maxViews spread evenly through the recording
+ */
+void buildViews(const vector< vector<TagObservation> >& observations,
+                const std::map<SquarePattern, tagPose>& tagMap, bool useMap,
+                vector< vector<Point3f> >& objectPoints, vector< vector<Point2f> >& imagePoints)
+{
+    vector< vector<Point3f> > allObject;
+    vector< vector<Point2f> > allImage;
+
+    for (int f = 0; f < observations.size(); f++)
+    {
+        vector<Point3f> object;
+        vector<Point2f> image;
+        for (int i = 0; i < observations[f].size(); i++)
+        {
+            const TagObservation& obs = observations[f][i];
+            if (useMap)
+            {
+                std::map<SquarePattern, tagPose>::const_iterator pose = tagMap.find(obs.pattern);
+                if (pose == tagMap.end())
+                    continue;
+                worldCorners(obs, pose->second, object);
+                image.insert(image.end(), obs.imageCorner, obs.imageCorner + 4);
+            }
+            else
+            {
+                vector<Point3f> tagObject(obs.object, obs.object + 4);
+                vector<Point2f> tagImage(obs.imageCorner, obs.imageCorner + 4);
+                allObject.push_back(tagObject);
+                allImage.push_back(tagImage);
+            }
+        }
+
+        if (!object.empty())
+        {
+            allObject.push_back(object);
+            allImage.push_back(image);
+        }
+    }
+
+    objectPoints.clear();
+    imagePoints.clear();
+    double step = std::max(1.0, (double)allObject.size() / maxViews);
+    for (double v = 0; v < allObject.size(); v += step)
+    {
+        objectPoints.push_back(allObject[(int)v]);
+        imagePoints.push_back(allImage[(int)v]);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        std::cerr << "usage: " << argv[0] << " <frames> <config out> [config in] [tag map] [stride]" << std::endl;
+        return 1;
+    }
+
+    FlyConfig config;
+    loadConfig((argc > 3)? argv[3] : "config/fly.yml", config);
+
+    std::map<SquarePattern, tagPose> tagMap;
+    bool useMap = (argc > 4) && readTagMap(argv[4], tagMap);
+    int stride = (argc > 5)? atoi(argv[5]) : 1;
+
+    FrameFileReader frames(argv[1]);
+    if (!frames.isOpen())
+        return 1;
+
+    // corners must be found in the raw frame to calibrate the distortion
+    bool sparseUndistort = config.camera.sparseUndistort;
+    config.camera.width = frames.width();
+    config.camera.height = frames.height();
+    config.camera.sparseUndistort = true;
+
+    auto start = std::chrono::steady_clock::now();
+    double rms = 0;
+
+    for (int round = 0; round < rounds; round++)
+    {
+        // the calibration changes every round, so caching its tables is wasted
+        TagDetector detector(config.camera, config.tag);
+
+        vector< vector<TagObservation> > observations;
+        detectFrames(frames, detector, observations, stride, 0, true);
+
+        vector< vector<Point3f> > objectPoints;
+        vector< vector<Point2f> > imagePoints;
+        buildViews(observations, tagMap, useMap, objectPoints, imagePoints);
+        if (objectPoints.size() < 3)
+        {
+            std::cerr << "only " << objectPoints.size() << " views of the tags were found" << std::endl;
+            return 1;
+        }
+
+        Mat cameraMatrix = config.camera.cameraMatrix.clone();
+        Mat distCoeffs = config.camera.distCoeffs.clone();
+        vector<Mat> rvecs, tvecs;
+        rms = calibrateCamera(objectPoints, imagePoints, Size(frames.width(), frames.height()),
+                              cameraMatrix, distCoeffs, rvecs, tvecs, CV_CALIB_USE_INTRINSIC_GUESS);
+
+        config.camera.cameraMatrix = cameraMatrix;
+        config.camera.distCoeffs = distCoeffs;
+
+        std::cerr << "round " << round << ": " << objectPoints.size() << " views, RMS "
+                  << rms << " px after "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(
+                         std::chrono::steady_clock::now() - start).count()
+                  << " ms" << std::endl;
+    }
+
+    std::cout << "cameraMatrix: " << config.camera.cameraMatrix << std::endl;
+    std::cout << "distCoeffs: " << config.camera.distCoeffs << std::endl;
+    std::cout << "RMS reprojection error: " << rms << " px" << std::endl;
+
+    config.camera.sparseUndistort = sparseUndistort;
+    return saveConfig(argv[2], config)? 0 : 1;
+}
@@ -0,0 +1,120 @@
+/******************************************
+ * capture_daemon.cpp
+ *
+ * Owns the econ camera and publishes its
+ * frames on the frame bus (see frameBus.h),
+ * so fly, a recorder and a debug viewer can
+ * all use the same frames without copying
+ * them, and a vision process that crashes
+ * does not take the camera down with it.
+ *
+ * usage: capture_daemon [config] [slots]
+ *
+ * The camera is set up from the camera
+ * section of the config, in its first mode
+ * if it has modes, and runs as the capture
+ * role of the realtime section. Build fly
+ * with USE_FRAME_BUS to read from the bus.
+ ******************************************/
+
+#include <iostream>
+#include <chrono>
+#include <signal.h>
+#include <stdlib.h>
+
+#include "config.h"
+#include "econ.h"
+#include "frameBus.h"
+#include "rtThread.h"
+
+static volatile sig_atomic_t running = 1;
+
+static void stop(int)
+{
+    running = 0;
+}
+
+int main(int argc, char** argv)
+{
+    FlyConfig config;
+    loadConfig((argc > 1)? argv[1] : "config/fly.yml", config);
+    int numSlots = (argc > 2)? atoi(argv[2]) : 4;
+    if (numSlots < 2) numSlots = 2;
+
+    if (config.realtime.lockMemory) lockMemory();
+    applyThreadConfig(pthread_self(), config.realtime.capture, "CAPTURE");
+
+    int device = (config.camera.device >= 0)? config.camera.device : defaultDevice;
+    econ camera(device, config.camera.width, config.camera.height);
+
+    if (!config.camera.modes.empty())
+    {
+        const CaptureMode& mode = config.camera.modes[0];
+        struct v4l2_rect crop;
+        crop.left = mode.crop.x;
+        crop.top = mode.crop.y;
+        crop.width = mode.crop.width;
+        crop.height = mode.crop.height;
+        camera.setMode(crop, mode.width, mode.height);
+    }
+
+    // the driver may have rounded the mode
+    struct v4l2_rect crop;
+    int width, height;
+    camera.getMode(crop, width, height);
+
+    FrameBusWriter bus(frameBusName(device), width, height, CV_8UC3, numSlots);
+    if (!bus.isOpen())
+        return 1;
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+
+    std::cerr << "publishing " << width << "x" << height << " frames from /dev/video" << device
+              << " on " << frameBusName(device) << std::endl;
+
+    cv::Mat scratch;
+    long published = 0, dropped = 0;
+    auto lastReport = std::chrono::steady_clock::now();
+
+    while (running)
+    {
+        // capture straight into shared memory; with every slot held
+        // the camera is still read so it does not fall behind
+        cv::Mat slot = bus.beginFrame();
+        if (slot.empty())
+        {
+            camera.readImg(scratch);
+            dropped++;
+        }
+        else
+        {
+            uchar* data = slot.data;
+            camera.readImg(slot);
+            if (slot.data != data)
+            {
+                // the frame went into a buffer of its own, not the slot
+                std::cerr << "FRAME SIZE CHANGED, THE FRAME WAS NOT PUBLISHED" << std::endl;
+                bus.abortFrame();
+                dropped++;
+            }
+            else
+            {
+                bus.commitFrame();
+                published++;
+            }
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastReport > std::chrono::seconds(5))
+        {
+            int reclaimed = bus.reclaim();
+            std::cerr << published << " frames published, " << dropped << " dropped";
+            if (reclaimed) std::cerr << ", " << reclaimed << " dead readers cleared";
+            std::cerr << std::endl;
+            lastReport = now;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,122 @@
+#include "controlScheduler.h"
+
+#include <iostream>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+static int64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+ControlScheduler::ControlScheduler(double rate)
+    : jitter_us(10, 500), execution_us(10, 500), missed_per_tick(1, 16)
+{
+    if (rate <= 0) rate = 200;
+    period_ns = (int64_t)(1e9 / rate);
+    deadlines = 0;
+    tick_count = 0;
+    missed_count = 0;
+    tick_start_ns = 0;
+
+    timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer < 0)
+    {
+        std::cerr << "COULD NOT CREATE THE CONTROL TIMER: " << strerror(errno) << std::endl;
+        return;
+    }
+
+    start_ns = now_ns();
+    struct itimerspec spec;
+    spec.it_value.tv_sec = (start_ns + period_ns) / 1000000000;
+    spec.it_value.tv_nsec = (start_ns + period_ns) % 1000000000;
+    spec.it_interval.tv_sec = period_ns / 1000000000;
+    spec.it_interval.tv_nsec = period_ns % 1000000000;
+    if (timerfd_settime(timer, TFD_TIMER_ABSTIME, &spec, NULL) < 0)
+    {
+        std::cerr << "COULD NOT START THE CONTROL TIMER: " << strerror(errno) << std::endl;
+        close(timer);
+        timer = -1;
+    }
+}
+
+ControlScheduler::~ControlScheduler()
+{
+    if (timer >= 0) close(timer);
+}
+
+bool ControlScheduler::isOpen()
+{
+    return timer >= 0;
+}
+
+// readable when a tick is due, for epoll
+int ControlScheduler::fd()
+{
+    return timer;
+}
+
+// seconds between ticks, the dt of the controller
+float ControlScheduler::period()
+{
+    return period_ns * 1e-9f;
+}
+
+// start a tick once fd is readable. Returns false if no deadline has
+// passed after all. Deadlines passed since the last tick, beyond the
+// one being served, are counted as missed.
+bool ControlScheduler::beginTick()
+{
+    uint64_t expired;
+    if (read(timer, &expired, sizeof(expired)) != sizeof(expired) || expired == 0)
+        return false;
+
+    tick_start_ns = now_ns();
+    deadlines += expired;
+    tick_count++;
+    missed_count += expired - 1;
+    missed_per_tick.record(expired - 1);
+
+    int64_t deadline = start_ns + (int64_t)deadlines * period_ns;
+    jitter_us.record((tick_start_ns - deadline) / 1000);
+    return true;
+}
+
+void ControlScheduler::endTick()
+{
+    execution_us.record((now_ns() - tick_start_ns) / 1000);
+}
+
+uint64_t ControlScheduler::ticks()
+{
+    return tick_count;
+}
+
+uint64_t ControlScheduler::missed()
+{
+    return missed_count;
+}
+
+const Histogram& ControlScheduler::jitter()
+{
+    return jitter_us;
+}
+
+const Histogram& ControlScheduler::execution()
+{
+    return execution_us;
+}
+
+void ControlScheduler::report(std::ostream& out)
+{
+    out << "control: " << tick_count << " ticks at " << 1e9 / period_ns << " Hz, "
+        << missed_count << " deadlines missed" << std::endl;
+    jitter_us.print(out, "  jitter", " us");
+    execution_us.print(out, "  execution", " us");
+    missed_per_tick.print(out, "  missed per tick", "");
+}
@@ -0,0 +1,556 @@
+#include "flightLog.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// the u64 index offset, u32 chunk count and end magic
+static const size_t trailer_size = 20;
+// u64 offset, u16 stream, u32 rows, u64 first and last time
+static const size_t index_entry_size = 30;
+
+static const double powers_of_ten[FLIGHT_LOG_MAX_DECIMALS + 1] = {
+    1, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9
+};
+
+static uint64_t zigzag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static void put_varint(std::vector<uint8_t>& out, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        out.push_back((uint8_t)v | 0x80);
+        v >>= 7;
+    }
+    out.push_back((uint8_t)v);
+}
+
+static bool get_varint(const uint8_t*& p, const uint8_t* end, uint64_t& v)
+{
+    v = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7)
+    {
+        uint8_t b = *p++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+template <typename T>
+static void put_le(std::vector<uint8_t>& out, T v)
+{
+    const uint8_t* bytes = (const uint8_t*)&v;
+    out.insert(out.end(), bytes, bytes + sizeof(v));
+}
+
+static void put_name(std::vector<uint8_t>& out, const std::string& name)
+{
+    size_t len = std::min(name.size(), (size_t)255);
+    out.push_back((uint8_t)len);
+    out.insert(out.end(), name.begin(), name.begin() + len);
+}
+
+// reads the header and index, failing rather than running off the end
+struct Cursor{
+    const uint8_t* p;
+    const uint8_t* end;
+    bool ok;
+
+    template <typename T>
+    T get()
+    {
+        T v = T();
+        if (ok && (size_t)(end - p) >= sizeof(v))
+        {
+            memcpy(&v, p, sizeof(v));
+            p += sizeof(v);
+        }
+        else
+        {
+            ok = false;
+        }
+        return v;
+    }
+
+    std::string name()
+    {
+        uint8_t len = get<uint8_t>();
+        if (!ok || (size_t)(end - p) < len)
+        {
+            ok = false;
+            return std::string();
+        }
+        std::string s((const char*)p, len);
+        p += len;
+        return s;
+    }
+};
+
+FlightLogChannel flightLogChannel(const std::string& name, uint8_t encoding, int decimals)
+{
+    FlightLogChannel channel;
+    channel.name = name;
+    channel.encoding = encoding;
+    channel.decimals = std::max(0, std::min(decimals, FLIGHT_LOG_MAX_DECIMALS));
+    return channel;
+}
+
+FlightLogWriter::FlightLogWriter()
+{
+    out = NULL;
+    failed = false;
+    offset = 0;
+}
+
+FlightLogWriter::~FlightLogWriter()
+{
+    close();
+}
+
+// returns the stream's number, or -1 once the log is open
+int FlightLogWriter::addStream(const std::string& name, const std::vector<FlightLogChannel>& channels)
+{
+    if (out || streams.size() >= 0xffff)
+        return -1;
+
+    FlightLogStream stream;
+    stream.name = name;
+    stream.channels = channels;
+    streams.push_back(stream);
+    pending.push_back(Pending());
+    return streams.size() - 1;
+}
+
+bool FlightLogWriter::open(const std::string& fileName)
+{
+    if (out)
+        return false;
+
+    out = fopen(fileName.c_str(), "wb");
+    if (!out)
+    {
+        std::cerr << "COULD NOT OPEN FLIGHT LOG " << fileName << std::endl;
+        return false;
+    }
+    failed = false;
+    offset = 0;
+    index.clear();
+
+    std::vector<uint8_t> header(FLIGHT_LOG_MAGIC, FLIGHT_LOG_MAGIC + 8);
+    put_le<uint16_t>(header, streams.size());
+    for (size_t s = 0; s < streams.size(); s++)
+    {
+        put_name(header, streams[s].name);
+        put_le<uint16_t>(header, streams[s].channels.size());
+        for (size_t c = 0; c < streams[s].channels.size(); c++)
+        {
+            const FlightLogChannel& channel = streams[s].channels[c];
+            put_name(header, channel.name);
+            header.push_back(channel.encoding);
+            header.push_back((uint8_t)channel.decimals);
+        }
+    }
+    return put(header.data(), header.size());
+}
+
+// add a row of a stream, with a value for each of its channels. Rows
+// of a stream should come in order of time, for the index to find
+// them; a value that is not finite repeats the one before on a delta
+// channel.
+bool FlightLogWriter::write(int stream, uint64_t time_us, const double* values)
+{
+    if (!out || failed || stream < 0 || stream >= (int)streams.size())
+        return false;
+
+    Pending& rows = pending[stream];
+    rows.times.push_back(time_us);
+    rows.values.insert(rows.values.end(), values, values + streams[stream].channels.size());
+    if (rows.times.size() >= FLIGHT_LOG_CHUNK_ROWS)
+        return flush(stream);
+    return true;
+}
+
+bool FlightLogWriter::flush(int stream)
+{
+    Pending& rows = pending[stream];
+    size_t n = rows.times.size();
+    if (n == 0)
+        return true;
+
+    const std::vector<FlightLogChannel>& channels = streams[stream].channels;
+    size_t width = channels.size();
+
+    FlightLogChunk entry;
+    entry.offset = offset;
+    entry.stream = stream;
+    entry.rows = n;
+    entry.first_us = *std::min_element(rows.times.begin(), rows.times.end());
+    entry.last_us = *std::max_element(rows.times.begin(), rows.times.end());
+
+    chunk.clear();
+    put_le<uint16_t>(chunk, stream);
+    put_le<uint32_t>(chunk, n);
+
+    column.clear();
+    uint64_t last_time = 0;
+    for (size_t r = 0; r < n; r++)
+    {
+        put_varint(column, zigzag((int64_t)(rows.times[r] - last_time)));
+        last_time = rows.times[r];
+    }
+    put_le<uint32_t>(chunk, column.size());
+    chunk.insert(chunk.end(), column.begin(), column.end());
+
+    for (size_t c = 0; c < width; c++)
+    {
+        column.clear();
+        if (channels[c].encoding == FLIGHT_LOG_DELTA)
+        {
+            double scale = powers_of_ten[channels[c].decimals];
+            int64_t last = 0;
+            for (size_t r = 0; r < n; r++)
+            {
+                double v = rows.values[r*width + c] * scale;
+                int64_t q = last;
+                if (std::isfinite(v) && std::fabs(v) < 9e18)
+                    q = llround(v);
+                put_varint(column, zigzag(q - last));
+                last = q;
+            }
+        }
+        else
+        {
+            for (size_t r = 0; r < n; r++)
+                put_le<float>(column, (float)rows.values[r*width + c]);
+        }
+        put_le<uint32_t>(chunk, column.size());
+        chunk.insert(chunk.end(), column.begin(), column.end());
+    }
+
+    rows.times.clear();
+    rows.values.clear();
+    if (!put(chunk.data(), chunk.size()))
+        return false;
+    index.push_back(entry);
+    return true;
+}
+
+bool FlightLogWriter::put(const void* data, size_t size)
+{
+    if (failed || fwrite(data, 1, size, out) != size)
+    {
+        if (!failed)
+            std::cerr << "COULD NOT WRITE FLIGHT LOG" << std::endl;
+        failed = true;
+        return false;
+    }
+    offset += size;
+    return true;
+}
+
+// write the rows left, the index and the trailer, and close the file
+bool FlightLogWriter::close()
+{
+    if (!out)
+        return false;
+
+    for (size_t s = 0; s < streams.size(); s++)
+        flush(s);
+
+    uint64_t index_offset = offset;
+    std::vector<uint8_t> tail;
+    for (size_t i = 0; i < index.size(); i++)
+    {
+        put_le<uint64_t>(tail, index[i].offset);
+        put_le<uint16_t>(tail, index[i].stream);
+        put_le<uint32_t>(tail, index[i].rows);
+        put_le<uint64_t>(tail, index[i].first_us);
+        put_le<uint64_t>(tail, index[i].last_us);
+    }
+    put_le<uint64_t>(tail, index_offset);
+    put_le<uint32_t>(tail, index.size());
+    tail.insert(tail.end(), FLIGHT_LOG_END, FLIGHT_LOG_END + 8);
+    put(tail.data(), tail.size());
+
+    if (fclose(out) != 0)
+        failed = true;
+    out = NULL;
+    return !failed;
+}
+
+uint64_t FlightLogWriter::bytes() const
+{
+    return offset;
+}
+
+FlightLogReader::FlightLogReader()
+{
+    map = NULL;
+    length = 0;
+}
+
+FlightLogReader::~FlightLogReader()
+{
+    close();
+}
+
+// map the file and read its schema and index; the chunks are only
+// read, a page at a time, as they are decoded
+bool FlightLogReader::open(const std::string& fileName)
+{
+    close();
+
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        std::cerr << "COULD NOT OPEN FLIGHT LOG " << fileName << std::endl;
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < 8 + 2 + trailer_size)
+    {
+        std::cerr << fileName << " IS NOT A FLIGHT LOG" << std::endl;
+        ::close(fd);
+        return false;
+    }
+
+    void* addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED)
+    {
+        std::cerr << "COULD NOT MAP FLIGHT LOG " << fileName << std::endl;
+        return false;
+    }
+    map = (uint8_t*)addr;
+    length = st.st_size;
+
+    Cursor tail = {map + length - trailer_size, map + length, true};
+    uint64_t index_offset = tail.get<uint64_t>();
+    uint32_t count = tail.get<uint32_t>();
+
+    bool ok = memcmp(map, FLIGHT_LOG_MAGIC, 8) == 0 &&
+              memcmp(map + length - 8, FLIGHT_LOG_END, 8) == 0 &&
+              index_offset + (uint64_t)count*index_entry_size + trailer_size == length;
+
+    Cursor header = {map + 8, map + (ok ? index_offset : 8), ok};
+    uint16_t stream_count = header.get<uint16_t>();
+    for (int s = 0; s < stream_count && header.ok; s++)
+    {
+        FlightLogStream stream;
+        stream.name = header.name();
+        uint16_t channel_count = header.get<uint16_t>();
+        for (int c = 0; c < channel_count && header.ok; c++)
+        {
+            FlightLogChannel channel;
+            channel.name = header.name();
+            channel.encoding = header.get<uint8_t>();
+            channel.decimals = header.get<int8_t>();
+            if (channel.decimals < 0 || channel.decimals > FLIGHT_LOG_MAX_DECIMALS)
+                header.ok = false;
+            stream.channels.push_back(channel);
+        }
+        schema.push_back(stream);
+    }
+
+    Cursor entries = {map + (header.ok ? index_offset : 0), map + length - trailer_size, header.ok};
+    for (uint32_t i = 0; i < count && entries.ok; i++)
+    {
+        FlightLogChunk entry;
+        entry.offset = entries.get<uint64_t>();
+        entry.stream = entries.get<uint16_t>();
+        entry.rows = entries.get<uint32_t>();
+        entry.first_us = entries.get<uint64_t>();
+        entry.last_us = entries.get<uint64_t>();
+        if (entry.offset >= index_offset || entry.stream >= schema.size())
+            entries.ok = false;
+        index.push_back(entry);
+    }
+
+    if (!entries.ok)
+    {
+        std::cerr << fileName << " IS NOT A FLIGHT LOG OR IS DAMAGED" << std::endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+void FlightLogReader::close()
+{
+    if (map)
+        munmap(map, length);
+    map = NULL;
+    length = 0;
+    schema.clear();
+    index.clear();
+}
+
+bool FlightLogReader::isOpen() const
+{
+    return map != NULL;
+}
+
+const std::vector<FlightLogStream>& FlightLogReader::streams() const
+{
+    return schema;
+}
+
+int FlightLogReader::findStream(const std::string& name) const
+{
+    for (size_t s = 0; s < schema.size(); s++)
+    {
+        if (schema[s].name == name)
+            return s;
+    }
+    return -1;
+}
+
+int FlightLogReader::findChannel(int stream, const std::string& name) const
+{
+    if (stream < 0 || stream >= (int)schema.size())
+        return -1;
+    for (size_t c = 0; c < schema[stream].channels.size(); c++)
+    {
+        if (schema[stream].channels[c].name == name)
+            return c;
+    }
+    return -1;
+}
+
+const std::vector<FlightLogChunk>& FlightLogReader::chunks() const
+{
+    return index;
+}
+
+uint64_t FlightLogReader::rows(int stream) const
+{
+    uint64_t n = 0;
+    for (size_t i = 0; i < index.size(); i++)
+    {
+        if (index[i].stream == stream)
+            n += index[i].rows;
+    }
+    return n;
+}
+
+// the first chunk of the stream with rows at or after time_us, or
+// chunks().size() if there is none
+size_t FlightLogReader::findChunk(int stream, uint64_t time_us) const
+{
+    for (size_t i = 0; i < index.size(); i++)
+    {
+        if (index[i].stream == stream && index[i].last_us >= time_us)
+            return i;
+    }
+    return index.size();
+}
+
+// find a column of a chunk, 0 being the time and 1 the first channel
+bool FlightLogReader::column(size_t chunk, int col, const uint8_t** data, size_t* size) const
+{
+    if (chunk >= index.size())
+        return false;
+
+    const uint8_t* end = map + length - trailer_size - index.size()*index_entry_size;
+    Cursor cursor = {map + index[chunk].offset, end, true};
+    cursor.get<uint16_t>();
+    cursor.get<uint32_t>();
+    for (int i = 0; cursor.ok; i++)
+    {
+        uint32_t len = cursor.get<uint32_t>();
+        if (!cursor.ok || (size_t)(end - cursor.p) < len)
+            break;
+        if (i == col)
+        {
+            *data = cursor.p;
+            *size = len;
+            return true;
+        }
+        cursor.p += len;
+    }
+    std::cerr << "FLIGHT LOG CHUNK " << chunk << " IS DAMAGED" << std::endl;
+    return false;
+}
+
+bool FlightLogReader::readTimes(size_t chunk, std::vector<uint64_t>& times) const
+{
+    const uint8_t* p;
+    size_t size;
+    if (!column(chunk, 0, &p, &size))
+        return false;
+
+    const uint8_t* end = p + size;
+    times.resize(index[chunk].rows);
+    uint64_t time = 0, v;
+    for (size_t r = 0; r < times.size(); r++)
+    {
+        if (!get_varint(p, end, v))
+            return false;
+        time += unzigzag(v);
+        times[r] = time;
+    }
+    return true;
+}
+
+bool FlightLogReader::readChannel(size_t chunk, int channel, std::vector<double>& values) const
+{
+    if (chunk >= index.size())
+        return false;
+    const std::vector<FlightLogChannel>& channels = schema[index[chunk].stream].channels;
+    if (channel < 0 || channel >= (int)channels.size())
+        return false;
+
+    const uint8_t* p;
+    size_t size;
+    if (!column(chunk, channel + 1, &p, &size))
+        return false;
+
+    const uint8_t* end = p + size;
+    size_t n = index[chunk].rows;
+    values.resize(n);
+    if (channels[channel].encoding == FLIGHT_LOG_DELTA)
+    {
+        double scale = powers_of_ten[channels[channel].decimals];
+        int64_t q = 0;
+        uint64_t v;
+        for (size_t r = 0; r < n; r++)
+        {
+            if (!get_varint(p, end, v))
+                return false;
+            q += unzigzag(v);
+            values[r] = q / scale;
+        }
+    }
+    else if (channels[channel].encoding == FLIGHT_LOG_FLOAT)
+    {
+        if (size < n*sizeof(float))
+            return false;
+        for (size_t r = 0; r < n; r++)
+        {
+            float v;
+            memcpy(&v, p + r*sizeof(float), sizeof(float));
+            values[r] = v;
+        }
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,234 @@
+/******************************************
+ * flow_sim.cpp
+ *
+ * Plays a PX4Flow into OpticalFlowSensor
+ * through a pseudo-terminal, so the serial
+ * path (open, termios, poll, read, parse,
+ * queue) can be run and loaded on any Linux
+ * machine without the sensor.
+ *
+ * The stream is a recorded one, played in a
+ * loop, or made up of flow frames with IMU
+ * and attitude frames in between. It is
+ * written in bursts of frames at the rate
+ * given, with random jitter on each burst and
+ * some bytes flipped if asked. A pty has no
+ * baud rate, so rates far above what 115200
+ * baud can carry are possible.
+ *
+ * usage: flow_sim [options]
+ *   -r <frames/s>   flow frames per second (400)
+ *   -b <frames>     frames written per burst (1)
+ *   -j <us>         jitter on each burst (0)
+ *   -c <fraction>   fraction of bytes flipped (0)
+ *   -f <file>       replay a recorded stream
+ *   -d <seconds>    run time (10)
+ *   -s              only serve the pty, for
+ *                   another process to open
+ ******************************************/
+
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+
+#include "optical_flow.h"
+#include "mavlinkParser.h"
+
+// a flow frame moving 1 cm a frame in x, and every other frame an
+// IMU or attitude frame, as a PX4Flow with an autopilot behind it
+static std::vector<uint8_t> make_frames(int count, std::vector<size_t>& ends)
+{
+    std::vector<uint8_t> stream;
+    uint8_t frame[MAVLINK_MAX_FRAME_LEN];
+    uint8_t payload[255];
+
+    for (int i = 0; i < count; i++)
+    {
+        memset(payload, 0, sizeof(payload));
+        uint64_t time_usec = i * 2500;
+        float flow_x = 1, flow_y = 0, distance = 0.5;
+        memcpy(payload, &time_usec, 8);
+        memcpy(payload + 8, &flow_x, 4);
+        memcpy(payload + 12, &flow_y, 4);
+        memcpy(payload + 16, &distance, 4);
+        payload[25] = 255;
+        stream.insert(stream.end(), frame,
+                      frame + mavlinkEncode(MAVLINK_ID_OPTICAL_FLOW, payload, 26, i, 81, 50, frame));
+        ends.push_back(stream.size());
+
+        memset(payload, 0, sizeof(payload));
+        memcpy(payload, &time_usec, 8);
+        if (i % 2 == 0)
+            stream.insert(stream.end(), frame,
+                          frame + mavlinkEncode(MAVLINK_ID_HIGHRES_IMU, payload, 62, i, 1, 1, frame));
+        else
+            stream.insert(stream.end(), frame,
+                          frame + mavlinkEncode(MAVLINK_ID_ATTITUDE, payload, 28, i, 1, 1, frame));
+        ends.push_back(stream.size());
+    }
+    return stream;
+}
+
+// where the frames of a recorded stream end, to cut it into bursts;
+// a start byte inside a payload splits a frame, which only makes a
+// burst a little shorter
+static std::vector<size_t> frame_ends(const std::vector<uint8_t>& stream)
+{
+    std::vector<size_t> ends;
+    for (size_t i = 1; i < stream.size(); i++)
+    {
+        if (stream[i] == MAVLINK_STX)
+            ends.push_back(i);
+    }
+    ends.push_back(stream.size());
+    return ends;
+}
+
+int main(int argc, char** argv)
+{
+    double rate = 400, corruption = 0, duration = 10;
+    int burst = 1, jitter = 0;
+    bool serveOnly = false;
+    std::string recording;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "r:b:j:c:f:d:s")) != -1)
+    {
+        if (opt == 'r') rate = atof(optarg);
+        else if (opt == 'b') burst = atoi(optarg);
+        else if (opt == 'j') jitter = atoi(optarg);
+        else if (opt == 'c') corruption = atof(optarg);
+        else if (opt == 'f') recording = optarg;
+        else if (opt == 'd') duration = atof(optarg);
+        else if (opt == 's') serveOnly = true;
+    }
+    if (rate <= 0) rate = 400;
+    if (burst < 1) burst = 1;
+
+    std::vector<uint8_t> stream;
+    std::vector<size_t> ends;
+    if (!recording.empty())
+    {
+        std::ifstream in(recording.c_str(), std::ios::binary);
+        stream.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        if (stream.empty())
+        {
+            std::cerr << "COULD NOT READ " << recording << std::endl;
+            return 1;
+        }
+        ends = frame_ends(stream);
+    }
+    else
+    {
+        stream = make_frames(1000, ends);
+    }
+
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0)
+    {
+        std::cerr << "COULD NOT CREATE A PTY: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    std::string device = ptsname(master);
+
+    // held open so the pty stays up between readers, and raw so no
+    // byte of the stream is taken as a line ending or control character
+    int slave = open(device.c_str(), O_RDWR | O_NOCTTY);
+    struct termios tty;
+    tcgetattr(slave, &tty);
+    cfmakeraw(&tty);
+    tcsetattr(slave, TCSANOW, &tty);
+
+    std::cerr << "serving a simulated PX4Flow on " << device << std::endl;
+
+    OpticalFlowSensor sensor;
+    if (!serveOnly)
+        std::thread(&OpticalFlowSensor::loop, &sensor, device).detach();
+
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int> jitterDist(-jitter, jitter);
+    std::uniform_int_distribution<int> bit(0, 7);
+    std::uniform_real_distribution<double> unit(0, 1);
+
+    auto start = std::chrono::steady_clock::now();
+    auto next = start;
+    auto lastReport = start;
+    auto end = start + std::chrono::microseconds((long)(duration*1e6));
+    std::chrono::microseconds period((long)(1e6*burst/rate));
+
+    size_t frame = 0;
+    uint64_t framesSent = 0, bytesSent = 0, flipped = 0;
+    uint64_t flowSamples = 0, other = 0;
+    std::vector<uint8_t> out;
+
+    while (std::chrono::steady_clock::now() < end)
+    {
+        // a burst of whole frames; the rate counts only flow frames
+        // on the made up stream, which has two frames for each
+        int frames = recording.empty() ? 2*burst : burst;
+        out.clear();
+        for (int i = 0; i < frames; i++)
+        {
+            size_t from = (frame > 0) ? ends[frame - 1] : 0;
+            out.insert(out.end(), stream.begin() + from, stream.begin() + ends[frame]);
+            frame = (frame + 1) % ends.size();
+        }
+        framesSent += frames;
+
+        for (size_t i = 0; i < out.size() && corruption > 0; i++)
+        {
+            if (unit(rng) < corruption)
+            {
+                out[i] ^= 1 << bit(rng);
+                flipped++;
+            }
+        }
+
+        if (write(master, out.data(), out.size()) < 0)
+        {
+            std::cerr << "WRITE TO PTY FAILED: " << strerror(errno) << std::endl;
+            return 1;
+        }
+        bytesSent += out.size();
+
+        // the control loop's side
+        FlowIntegral flow;
+        if (sensor.drainFlow(flow)) flowSamples += flow.samples;
+        MavlinkHighresImu imu;
+        while (sensor.getImu(imu)) other++;
+        MavlinkAttitude attitude;
+        while (sensor.getAttitude(attitude)) other++;
+        MavlinkOpticalFlow message;
+        while (sensor.getFlowMessage(message));
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastReport >= std::chrono::seconds(1))
+        {
+            double elapsed = std::chrono::duration<double>(now - start).count();
+            std::cerr << "sent " << framesSent << " frames, " << bytesSent/elapsed/1000 << " kB/s"
+                      << " (" << bytesSent*10/elapsed << " baud), " << flipped << " bytes flipped";
+            if (!serveOnly)
+                std::cerr << "; received " << flowSamples << " flow, " << other << " IMU/attitude, "
+                          << sensor.droppedSamples() << " dropped";
+            std::cerr << std::endl;
+            lastReport = now;
+        }
+
+        next += period + std::chrono::microseconds(jitterDist(rng));
+        std::this_thread::sleep_until(next);
+    }
+
+    // the sensor thread never returns
+    _exit(0);
+}
@@ -3,12 +3,21 @@
 #include <iostream>
 #include <iomanip>
 #include <fstream>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
 
 
 #include "optical_flow.h"
-#include "cameraPoseEstimator.h"
+#include "cameraRig.h"
 #include "PID.h"
 #include "GPIO.h"
+#include "sharedState.h"
+#include "controlScheduler.h"
+#include "rtThread.h"
+#include "pwmOutput.h"
+#include "logger.h"
 
 
 int constrain(int a, int x, int y){
@@ -26,31 +35,76 @@ int constrain(int a, int x, int y){
 	}
 }
 
-int main()
+int main(int argc, char** argv)
 {
-    CameraPoseEstimator cpe;
+    // -c <config>  : settings to fly with (config/fly.yml)
+    // -r <frames>  : record the first camera to a frame file for build_map
+    // -m <tag map> : start with the tags of a map built by build_map
+    std::string configFile("config/fly.yml"), recordFile;
+    FlyConfig config;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:r:m:")) != -1)
+    {
+        if (opt == 'c') configFile = optarg;
+        else if (opt == 'r') recordFile = optarg;
+        else if (opt == 'm') config.tagMap = optarg;
+    }
+
+    std::string tagMap = config.tagMap;
+    loadConfig(configFile, config);
+    if (!tagMap.empty()) config.tagMap = tagMap;
+
+    // before any thread starts, so their stacks are locked as well
+    if (config.realtime.lockMemory)
+    {
+        lockMemory();
+        prefaultStack(256*1024);
+    }
+    applyThreadConfig(pthread_self(), config.realtime.control, "CONTROL LOOP");
+
+    // the control loop only queues records; this thread writes them out
+    if (startLogger(config.logging.file, config.logging.console))
+        applyThreadConfig(loggerThread(), config.realtime.logging, "LOGGER");
+
+    CameraRig rig(config);
     OpticalFlowSensor ofs;
+    StatePublisher publisher;
+    FlyState state = FlyState();
+    auto startTime = std::chrono::steady_clock::now();
+
+    if (!recordFile.empty()) rig.record(recordFile);
 
-    initGPIO(10, true);
+    GPIO armSwitch(config.gpio.armSwitch, true, config.gpio.root);
 
-    std::thread cpe_thread(&CameraPoseEstimator::continuousRead, &cpe);
+    rig.start();
     std::thread ofs_thread(&OpticalFlowSensor::loop, &ofs, std::string("/dev/ttyO0"));
+    applyThreadConfig(ofs_thread.native_handle(), config.realtime.flow, "FLOW READER");
 	
     float x = 0, y = 0, z = 0;
     float rollError=0, pitchError=0, throttleError=0;
     
     PID Pitch, Roll, Throttle;
-    Pitch.setP(15);
-    Roll.setP(15);
-    Pitch.setI(10);
-    Roll.setI(10);
+    Pitch.setP(config.pitch.P);
+    Roll.setP(config.roll.P);
+    Throttle.setP(config.throttle.P);
+    Pitch.setI(config.pitch.I);
+    Roll.setI(config.roll.I);
+    Throttle.setI(config.throttle.I);
+    Pitch.setWindupGuard(config.pitch.windupGuard);
+    Roll.setWindupGuard(config.roll.windupGuard);
+    Throttle.setWindupGuard(config.throttle.windupGuard);
     Throttle.setPwmOut(10000);
+
+    // the controllers run on the scheduler's ticks, so their step is fixed
+    ControlScheduler scheduler(config.control.rate);
+    Pitch.setSampleTime(scheduler.period());
+    Roll.setSampleTime(scheduler.period());
+    Throttle.setSampleTime(scheduler.period());
+    auto lastReport = std::chrono::steady_clock::now();
     float setPointX=0, setPointY=0, setPointZ=0;
     bool inFlight = false, prevFlightStatus=false, firstRead=true;
-    std::ofstream PWM8("/dev/pwm8"); //Throttle
-    std::ofstream PWM9("/dev/pwm9"); //Roll
-    std::ofstream PWM10("/dev/pwm10"); //Pitch
-    std::ofstream PWM11("/dev/pwm11"); //Yaw
+    std::string pwmDevices[PWM_CHANNELS] = {config.pwm.throttle, config.pwm.roll, config.pwm.pitch, config.pwm.yaw};
+    PwmOutput pwm(pwmDevices);
     //float pidRoll, pidPitch, pidThrottle;
 
     
@@ -60,42 +114,93 @@ int main()
     //writeGPIO(16, true);
     //initGPIO(17,true);
 
+    // wake when a sensor has something new, to fold it into the
+    // estimate at once, or when a control tick is due
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    int sources[] = {ofs.eventFd(), rig.eventFd(), scheduler.fd()};
+    for (int i = 0; i < 3; i++)
+    {
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = sources[i];
+        if (sources[i] < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, sources[i], &ev) < 0)
+            std::cerr << "COULD NOT WAIT ON EVENT SOURCE " << i << ": " << strerror(errno) << std::endl;
+    }
+
+    // no camera has a recent pose; x and y then follow the flow alone
+    bool poseLost = false;
+
+    // the arm switch signals its edges when the pin supports it; a
+    // file standing in for it cannot, and is read every tick instead
+    bool armEvents = false;
+    if (armSwitch.isOpen() && armSwitch.setEdge("both"))
+    {
+        struct epoll_event ev;
+        ev.events = EPOLLPRI | EPOLLERR;
+        ev.data.fd = armSwitch.fd();
+        armEvents = epoll_ctl(epfd, EPOLL_CTL_ADD, armSwitch.fd(), &ev) == 0;
+    }
+    char armState = armSwitch.read();
+
     while (true)
     {
-        if(readGPIO(10)=='1') inFlight=true;
-        if(readGPIO(10)=='0') inFlight=false;
-        
-	if(inFlight == true && prevFlightStatus == false)
-	{
-		setPointX=x;
-		setPointY=y;
-		setPointZ = .5;
-		Pitch.zeroIntegralError();
-		Roll.zeroIntegralError();
-		Pitch.setPwmOut(15000);
-		Roll.setPwmOut(15000);
-	}
-	
-	prevFlightStatus=inFlight;
-	
+        struct epoll_event events[4];
+        int n = epoll_wait(epfd, events, 4, -1);
+        if (n < 0 && errno != EINTR)
+            std::cerr << "EPOLL FAILED: " << strerror(errno) << std::endl;
 
-	FlowData fd;
+        bool tick = false;
+        for (int i = 0; i < n; i++)
+        {
+            if (events[i].data.fd == scheduler.fd())
+            {
+                tick = scheduler.beginTick();
+                continue;
+            }
+            if (events[i].data.fd == armSwitch.fd())
+            {
+                armState = armSwitch.read();
+                continue;
+            }
+            // clear the eventfd
+            uint64_t count;
+            read(events[i].data.fd, &count, sizeof(count));
+        }
+
+	FlowIntegral flow;
 	Pose3D pose;
 	
-        if (ofs.dataReady())
+        // every sample since the last pass, however fast the sensor sends
+        if (ofs.drainFlow(flow))
+	{
+	    state.flow_x = flow.dx;
+	    state.flow_y = flow.dy;
+	    state.ground_distance = flow.ground_distance;
+	    x += flow.dx;
+	    y += flow.dy;
+	    z = flow.ground_distance;
+	    logRecord(LOG_FLOW, flow.dx, flow.dy, flow.ground_distance, flow.samples);
+	}
+	bool newPose = rig.dataAvailable();
+	if (newPose && !rig.getPose(pose))
 	{
-	    fd = ofs.getFlowData();
-	    //std::cout << fd.flow_x << " "
-	    //	      << fd.flow_y << " "
-	    //	      << std::endl;
-	    x += fd.flow_x;
-	    y += fd.flow_y;
-	    z = fd.ground_distance;
-	   	    //std::cout << std::chrono::nanoseconds(dt).count()/10e6 << std::endl;
+	    if (!poseLost)
+		std::cerr << "NO RECENT CAMERA POSE, POSITION FROM OPTICAL FLOW ONLY" << std::endl;
+	    poseLost = true;
+	    newPose = false;
 	}
-	if (cpe.dataAvailable())
+	if (newPose)
 	{
-	    cpe.getPose(pose);
+	    if (poseLost)
+		std::cerr << "CAMERA POSE RECOVERED" << std::endl;
+	    poseLost = false;
+	    state.x = pose.x;
+	    state.y = pose.y;
+	    state.z = pose.z;
+	    state.psi = pose.psi;
+	    state.theta = pose.theta;
+	    state.phi = pose.phi;
+	    logRecord(LOG_POSE, pose.x, pose.y, pose.z, pose.psi, pose.theta, pose.phi);
 	
 	    x = pose.x;
    	    y = pose.y;
@@ -118,7 +223,27 @@ int main()
 
 	    */	   
 	}
+
+	if (!tick) continue;
+
+        if(!armEvents) armState = armSwitch.read();
+        if(armState=='1') inFlight=true;
+        if(armState=='0') inFlight=false;
+        
+	if(inFlight == true && prevFlightStatus == false)
+	{
+		setPointX=x;
+		setPointY=y;
+		setPointZ = .5;
+		Pitch.zeroIntegralError();
+		Roll.zeroIntegralError();
+		Pitch.setPwmOut(15000);
+		Roll.setPwmOut(15000);
+	}
 	
+	prevFlightStatus=inFlight;
+	
+
 	 pitchError=Pitch.updatePID(setPointX, x, inFlight);
 	 rollError=Roll.updatePID(setPointY, -y, inFlight);
 	 throttleError=Throttle.updatePID(setPointZ, z, inFlight);
@@ -128,21 +253,44 @@ int main()
 	 //Throttle.setPwmOut(constrain((Throttle.getPwmOut()+(throttleError*100)),1000,2000));
 	 //PW8<<Throttle.getPwmOut();
 	 
-	 PWM9<<15121-Roll.getPwmOut() << std::flush;
-	 PWM10<<15121+Pitch.getPwmOut() << std::flush;
-	 //PWM8<<10121+Throttle.getPwmOut()<<std::flush;
-         PWM8<<15000<<std::flush;	 
+	 pwm.set(PWM_ROLL, 15121-Roll.getPwmOut());
+	 pwm.set(PWM_PITCH, 15121+Pitch.getPwmOut());
+	 //pwm.set(PWM_THROTTLE, 10121+Throttle.getPwmOut());
+	 pwm.set(PWM_THROTTLE, 15000);
+	 pwm.write();
 
 
-	 std::cout<<"Roll: "<<15121-Roll.getPwmOut()<<"\t";
-	 std::cout<<"Pitch: "<<15121+Pitch.getPwmOut()<<"\t";
-         std::cout<<"Throttle: "<<10121+Throttle.getPwmOut()<<"\t";
-	 if(inFlight) std::cout<<"Switch Flipped";
-	 std::cout<<std::endl;
+	 logRecord(LOG_CONTROL, 15121-Roll.getPwmOut(), 15121+Pitch.getPwmOut(),
+	           10121+Throttle.getPwmOut(), 0, 0, 0, inFlight);
 	
-	std::cout <<"X: "<< x <<" cm"<< " Y:" << y << " cm Z: " << z <<" m" << std::ends;
+	// for state_reader and anything else watching from outside
+	state.time_us = std::chrono::duration_cast<std::chrono::microseconds>(
+	    std::chrono::steady_clock::now() - startTime).count();
+	state.updates++;
+	state.setPointX = setPointX;
+	state.setPointY = setPointY;
+	state.setPointZ = setPointZ;
+	state.pwmRoll = 15121-Roll.getPwmOut();
+	state.pwmPitch = 15121+Pitch.getPwmOut();
+	state.pwmThrottle = 15000;
+	state.pwmYaw = 0;
+	state.inFlight = inFlight;
+	publisher.publish(state);
+
+	logRecord(LOG_POSITION, x, y, z);
 	//std::cout << std::setw(10) << pitchError << " " << std::setw(10) << rollError << " " << std::setw(10) << throttleError << std::endl;
 
-	std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	scheduler.endTick();
+	if (config.control.reportInterval > 0 &&
+	    std::chrono::steady_clock::now() - lastReport > std::chrono::duration<double>(config.control.reportInterval))
+	{
+	    scheduler.report(std::cerr);
+	    pwm.latency().print(std::cerr, "  pwm output", " us");
+	    if (pwm.failures() > 0)
+	        std::cerr << "  " << pwm.failures() << " pwm writes failed" << std::endl;
+	    if (loggerDropped() > 0)
+	        std::cerr << "  " << loggerDropped() << " log records dropped" << std::endl;
+	    lastReport = std::chrono::steady_clock::now();
+	}
     }
 }
@@ -0,0 +1,68 @@
+#include "histogram.h"
+
+#include <algorithm>
+
+Histogram::Histogram(int64_t bucket_width, int buckets)
+    : bucket_width(bucket_width), counts(buckets + 1, 0)
+{
+    reset();
+}
+
+void Histogram::record(int64_t value)
+{
+    if (value < 0) value = 0;
+    size_t bucket = value / bucket_width;
+    if (bucket >= counts.size()) bucket = counts.size() - 1;
+    counts[bucket]++;
+    total++;
+    sum += value;
+    if (value > max_value) max_value = value;
+}
+
+void Histogram::reset()
+{
+    for (size_t i = 0; i < counts.size(); i++)
+        counts[i] = 0;
+    total = 0;
+    max_value = 0;
+    sum = 0;
+}
+
+uint64_t Histogram::count() const
+{
+    return total;
+}
+
+int64_t Histogram::max() const
+{
+    return max_value;
+}
+
+double Histogram::mean() const
+{
+    return total ? sum / total : 0;
+}
+
+// the upper edge of the bucket the p-th fraction of values fall in,
+// no more than the largest value seen
+int64_t Histogram::percentile(double p) const
+{
+    uint64_t target = (uint64_t)(p * total);
+    uint64_t seen = 0;
+    for (size_t i = 0; i + 1 < counts.size(); i++)
+    {
+        seen += counts[i];
+        if (seen > target)
+            return std::min<int64_t>((i + 1) * bucket_width, max_value);
+    }
+    return max_value;
+}
+
+void Histogram::print(std::ostream& out, const char* name, const char* unit) const
+{
+    out << name << ": mean " << mean() << unit
+        << " p50 " << percentile(0.5) << unit
+        << " p99 " << percentile(0.99) << unit
+        << " p99.9 " << percentile(0.999) << unit
+        << " max " << max() << unit << std::endl;
+}
@@ -0,0 +1,600 @@
+/******************************************
+ * log_convert.cpp
+ *
+ * Converts a log of fly to a flight log (see
+ * flightLog.h), checks the flight log reads
+ * back to the same values, and prints how
+ * much smaller it is and how much faster it
+ * loads.
+ *
+ * Two kinds of log are read:
+ *  - the binary log fly writes now, from
+ *    LOG_MAGIC; every record type becomes a
+ *    stream, with its rows sorted by time.
+ *  - the text logs of earlier flights, as in
+ *    data/, with lines such as
+ *      Roll: 1500	Pitch: 1480
+ *      Roll: 1500	Pitch: 1480	Throttle: 1300	Switch Flipped
+ *      X: 1.5 cm Y:-2 cm Z: 0.8 m
+ *      1.24624  -0.198701     -4.728
+ *    (data/sample_flight.txt has the first
+ *    three, as fly prints them now.)
+ *    Each form of line becomes a stream with a
+ *    channel per value, named by its label, or
+ *    c1, c2, ... for bare columns. Each channel
+ *    keeps as many decimals as the text had,
+ *    so nothing is lost. Lines of anything else,
+ *    such as the source code caught in some of
+ *    the logs, are skipped. The text has no
+ *    clock, so each row's time is its line
+ *    number.
+ *
+ * usage: log_convert <log> [flight log]
+ *   the flight log defaults to the log's name
+ *   with the extension .qflt. Fails if nothing
+ *   in the log could be read, and warns if most
+ *   lines of a text log were skipped.
+ ******************************************/
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "flightLog.h"
+#include "logger.h"
+
+struct Table{
+    std::string name;
+    std::vector<FlightLogChannel> channels;
+    std::vector<uint64_t> times;
+    std::vector<std::vector<double> > columns;
+};
+
+// a number as the text logs print it; decimals is how many places it
+// needs to be kept exactly, which may be more than FLIGHT_LOG_MAX_DECIMALS
+static bool parse_number(const char*& s, const char* end, double& value, int& decimals)
+{
+    const char* p = s;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = (*p++ == '-');
+
+    uint64_t mantissa = 0;
+    int digits = 0, fraction = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++, digits++)
+        mantissa = mantissa*10 + (*p - '0');
+    if (p < end && *p == '.')
+    {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++, digits++, fraction++)
+            mantissa = mantissa*10 + (*p - '0');
+    }
+    if (digits == 0 || digits > 18)
+        return false;
+
+    int exponent = 0;
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        p++;
+        bool negativeExponent = false;
+        if (p < end && (*p == '-' || *p == '+'))
+            negativeExponent = (*p++ == '-');
+        if (p == end || *p < '0' || *p > '9')
+            return false;
+        for (; p < end && *p >= '0' && *p <= '9' && exponent < 1000; p++)
+            exponent = exponent*10 + (*p - '0');
+        if (negativeExponent)
+            exponent = -exponent;
+    }
+    if (p < end && *p != ' ' && *p != '\t' && *p != '\r')
+        return false;
+
+    decimals = std::max(0, fraction - exponent);
+    value = (fraction - exponent > 0) ? mantissa / std::pow(10.0, fraction - exponent)
+                                      : mantissa * std::pow(10.0, exponent - fraction);
+    if (negative)
+        value = -value;
+    s = p;
+    return true;
+}
+
+struct Field{
+    const char* name;
+    size_t length;
+    double value;
+    int decimals;
+};
+
+static const int max_fields = 16;
+
+// the values on a line, or -1 if it is not a line of a log
+static int parse_line(const char* p, const char* end, Field* fields, bool& flipped)
+{
+    static const char* columns[max_fields] = {"c1", "c2", "c3", "c4", "c5", "c6", "c7", "c8",
+                                              "c9", "c10", "c11", "c12", "c13", "c14", "c15", "c16"};
+    int n = 0, bare = 0;
+    const char* label = NULL;
+    size_t labelLength = 0;
+    flipped = false;
+
+    for (;;)
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+            p++;
+        if (p == end)
+            break;
+
+        char c = *p;
+        if ((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.')
+        {
+            if (n == max_fields || !parse_number(p, end, fields[n].value, fields[n].decimals))
+                return -1;
+            if (label)
+            {
+                fields[n].name = label;
+                fields[n].length = labelLength;
+                label = NULL;
+            }
+            else
+            {
+                fields[n].name = columns[bare];
+                fields[n].length = strlen(columns[bare]);
+                bare++;
+            }
+            n++;
+            continue;
+        }
+
+        const char* word = p;
+        while (p < end && ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || *p == '_' ||
+                           (p > word && *p >= '0' && *p <= '9')))
+            p++;
+        size_t length = p - word;
+        if (length == 0)
+            return -1;
+
+        if (p < end && *p == ':')
+        {
+            label = word;
+            labelLength = length;
+            p++;
+        }
+        else if ((length == 2 && memcmp(word, "cm", 2) == 0) || (length == 1 && *word == 'm'))
+        {
+            // the units of the position
+        }
+        else if (length == 6 && memcmp(word, "Switch", 6) == 0)
+        {
+            while (p < end && *p == ' ')
+                p++;
+            if (end - p < 7 || memcmp(p, "Flipped", 7) != 0)
+                return -1;
+            p += 7;
+            flipped = true;
+        }
+        else
+        {
+            return -1;
+        }
+    }
+    return n;
+}
+
+static bool map_file(const std::string& fileName, const char** data, size_t* size)
+{
+    int fd = open(fileName.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        std::cerr << "COULD NOT OPEN " << fileName << std::endl;
+        if (fd >= 0) close(fd);
+        return false;
+    }
+
+    *size = st.st_size;
+    *data = "";
+    if (*size > 0)
+    {
+        void* addr = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED)
+        {
+            std::cerr << "COULD NOT MAP " << fileName << std::endl;
+            close(fd);
+            return false;
+        }
+        *data = (const char*)addr;
+    }
+    close(fd);
+    return true;
+}
+
+static void read_text(const char* data, size_t size, std::vector<Table>& tables, uint64_t& skipped)
+{
+    std::map<std::string, int> streams;
+    // the channel of each table for "Switch Flipped", once it has been seen
+    std::vector<int> switches;
+    Field fields[max_fields];
+    std::string key;
+    int last = -1;
+    std::string lastKey;
+
+    const char* end = data + size;
+    uint64_t line = 0;
+    for (const char* p = data; p < end; )
+    {
+        const char* eol = (const char*)memchr(p, '\n', end - p);
+        if (!eol)
+            eol = end;
+        line++;
+
+        bool flipped;
+        int n = parse_line(p, eol, fields, flipped);
+        p = eol + 1;
+        if (n <= 0)
+        {
+            skipped++;
+            continue;
+        }
+
+        // lines of one form mostly follow each other, so only look up
+        // the table when the form changes
+        key.clear();
+        for (int i = 0; i < n; i++)
+        {
+            if (i) key += ' ';
+            key.append(fields[i].name, fields[i].length);
+        }
+        if (last < 0 || key != lastKey)
+        {
+            std::map<std::string, int>::iterator found = streams.find(key);
+            if (found == streams.end())
+            {
+                Table table;
+                bool bare = key.compare(0, 2, "c1") == 0 && (key.size() == 2 || key[2] == ' ');
+                table.name = bare ? "columns" + std::to_string(n) : key;
+                for (int i = 0; i < n; i++)
+                    table.channels.push_back(flightLogChannel(std::string(fields[i].name, fields[i].length),
+                                                              FLIGHT_LOG_DELTA, 0));
+                table.columns.resize(n);
+                found = streams.insert(std::make_pair(key, (int)tables.size())).first;
+                tables.push_back(table);
+                switches.push_back(-1);
+            }
+            last = found->second;
+            lastKey = key;
+        }
+
+        Table& table = tables[last];
+        for (int i = 0; i < n; i++)
+        {
+            FlightLogChannel& channel = table.channels[i];
+            if (fields[i].decimals > FLIGHT_LOG_MAX_DECIMALS)
+                channel.encoding = FLIGHT_LOG_FLOAT;
+            else if (fields[i].decimals > channel.decimals)
+                channel.decimals = fields[i].decimals;
+            table.columns[i].push_back(fields[i].value);
+        }
+        if (flipped && switches[last] < 0)
+        {
+            switches[last] = table.channels.size();
+            table.channels.push_back(flightLogChannel("Switch", FLIGHT_LOG_DELTA, 0));
+            table.columns.push_back(std::vector<double>(table.times.size(), 0));
+        }
+        if (switches[last] >= 0)
+            table.columns[switches[last]].push_back(flipped ? 1 : 0);
+        table.times.push_back(line);
+    }
+}
+
+static bool read_binary(const char* data, size_t size, std::vector<Table>& tables)
+{
+    size_t count = (size - 8) / sizeof(LogRecord);
+    if ((size - 8) % sizeof(LogRecord) != 0)
+        std::cerr << "the log ends in part of a record, which is left out" << std::endl;
+
+    std::vector<LogRecord> records(count);
+    if (count > 0)
+        memcpy(records.data(), data + 8, count*sizeof(LogRecord));
+
+    // the rings of the threads were written out in turn, so records
+    // of a type can be out of order
+    std::stable_sort(records.begin(), records.end(),
+                     [](const LogRecord& a, const LogRecord& b) { return a.time_us < b.time_us; });
+
+    std::map<int, int> streams;
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        const LogRecord& record = records[i];
+        std::map<int, int>::iterator found = streams.find(record.type);
+        if (found == streams.end())
+        {
+            Table table;
+            std::vector<FlightLogChannel>& c = table.channels;
+            switch (record.type)
+            {
+            case LOG_CONTROL:
+                table.name = "control";
+                c.push_back(flightLogChannel("roll", FLIGHT_LOG_DELTA));
+                c.push_back(flightLogChannel("pitch", FLIGHT_LOG_DELTA));
+                c.push_back(flightLogChannel("throttle", FLIGHT_LOG_DELTA));
+                c.push_back(flightLogChannel("switch", FLIGHT_LOG_DELTA));
+                break;
+            case LOG_POSITION:
+                table.name = "position";
+                c.push_back(flightLogChannel("x", FLIGHT_LOG_FLOAT));
+                c.push_back(flightLogChannel("y", FLIGHT_LOG_FLOAT));
+                c.push_back(flightLogChannel("z", FLIGHT_LOG_FLOAT));
+                break;
+            case LOG_FLOW:
+                table.name = "flow";
+                c.push_back(flightLogChannel("dx", FLIGHT_LOG_FLOAT));
+                c.push_back(flightLogChannel("dy", FLIGHT_LOG_FLOAT));
+                c.push_back(flightLogChannel("ground_distance", FLIGHT_LOG_FLOAT));
+                c.push_back(flightLogChannel("samples", FLIGHT_LOG_DELTA));
+                break;
+            case LOG_POSE:
+                table.name = "pose";
+                c.push_back(flightLogChannel("x", FLIGHT_LOG_FLOAT));
+                c.push_back(flightLogChannel("y", FLIGHT_LOG_FLOAT));
+                c.push_back(flightLogChannel("z", FLIGHT_LOG_FLOAT));
+                c.push_back(flightLogChannel("psi", FLIGHT_LOG_FLOAT));
+                c.push_back(flightLogChannel("theta", FLIGHT_LOG_FLOAT));
+                c.push_back(flightLogChannel("phi", FLIGHT_LOG_FLOAT));
+                break;
+            case LOG_FRAME_READ:
+                table.name = "frame read";
+                c.push_back(flightLogChannel("us", FLIGHT_LOG_DELTA));
+                break;
+            default:
+                table.name = "type " + std::to_string(record.type);
+                for (int v = 0; v < LOG_VALUES; v++)
+                    c.push_back(flightLogChannel("v" + std::to_string(v), FLIGHT_LOG_FLOAT));
+                c.push_back(flightLogChannel("flags", FLIGHT_LOG_DELTA));
+                break;
+            }
+            table.columns.resize(c.size());
+            found = streams.insert(std::make_pair((int)record.type, (int)tables.size())).first;
+            tables.push_back(table);
+        }
+
+        Table& table = tables[found->second];
+        size_t values = table.channels.size();
+        bool hasFlags = (record.type == LOG_CONTROL || values > LOG_VALUES);
+        if (hasFlags)
+            values--;
+        for (size_t v = 0; v < values; v++)
+            table.columns[v].push_back(record.values[v]);
+        if (hasFlags)
+            table.columns[values].push_back(record.flags);
+        table.times.push_back(record.time_us);
+    }
+    return true;
+}
+
+// a channel with many decimals that changes a lot from line to line
+// takes fewer bytes as a float, which holds the six digits the logs
+// were printed with
+static void choose_encodings(std::vector<Table>& tables)
+{
+    for (size_t t = 0; t < tables.size(); t++)
+    {
+        for (size_t c = 0; c < tables[t].channels.size(); c++)
+        {
+            FlightLogChannel& channel = tables[t].channels[c];
+            if (channel.encoding != FLIGHT_LOG_DELTA)
+                continue;
+
+            const std::vector<double>& column = tables[t].columns[c];
+            double scale = std::pow(10.0, channel.decimals);
+            int64_t last = 0;
+            size_t bytes = 0;
+            for (size_t r = 0; r < column.size(); r++)
+            {
+                int64_t q = llround(column[r] * scale);
+                // the zigzag varint of the change
+                int64_t d = q - last;
+                uint64_t delta = ((uint64_t)d << 1) ^ (uint64_t)(d >> 63);
+                for (bytes++; delta >= 0x80; delta >>= 7)
+                    bytes++;
+                last = q;
+            }
+            if (bytes > column.size() * sizeof(float))
+                channel.encoding = FLIGHT_LOG_FLOAT;
+        }
+    }
+}
+
+static bool write_tables(const std::vector<Table>& tables, const std::string& fileName, uint64_t& bytes)
+{
+    FlightLogWriter writer;
+    for (size_t t = 0; t < tables.size(); t++)
+        writer.addStream(tables[t].name, tables[t].channels);
+    if (!writer.open(fileName))
+        return false;
+
+    std::vector<double> row;
+    for (size_t t = 0; t < tables.size(); t++)
+    {
+        const Table& table = tables[t];
+        row.resize(table.columns.size());
+        for (size_t r = 0; r < table.times.size(); r++)
+        {
+            for (size_t c = 0; c < row.size(); c++)
+                row[c] = table.columns[c][r];
+            writer.write(t, table.times[r], row.data());
+        }
+    }
+    bool ok = writer.close();
+    bytes = writer.bytes();
+    return ok;
+}
+
+// read every value of the flight log back and compare with the log
+static bool verify(const FlightLogReader& reader, const std::vector<Table>& tables)
+{
+    std::vector<size_t> done(tables.size(), 0);
+    std::vector<uint64_t> times;
+    std::vector<double> values;
+    const std::vector<FlightLogChunk>& chunks = reader.chunks();
+
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+        int s = chunks[i].stream;
+        const Table& table = tables[s];
+        size_t from = done[s];
+        if (!reader.readTimes(i, times) || from + times.size() > table.times.size() ||
+            !std::equal(times.begin(), times.end(), table.times.begin() + from))
+            return false;
+
+        for (size_t c = 0; c < table.channels.size(); c++)
+        {
+            if (!reader.readChannel(i, c, values))
+                return false;
+            const FlightLogChannel& channel = table.channels[c];
+            // delta channels are rounded to their decimals, floats are exact
+            bool delta = channel.encoding == FLIGHT_LOG_DELTA;
+            double tolerance = delta ? 0.5 / std::pow(10.0, channel.decimals) : 0;
+            for (size_t r = 0; r < values.size(); r++)
+            {
+                double expected = table.columns[c][from + r];
+                if (!delta)
+                    expected = (float)expected;
+                if (std::fabs(values[r] - expected) > tolerance)
+                    return false;
+            }
+        }
+        done[s] += times.size();
+    }
+
+    for (size_t t = 0; t < tables.size(); t++)
+    {
+        if (done[t] != tables[t].times.size())
+            return false;
+    }
+    return true;
+}
+
+// open the flight log and decode every channel of every chunk, as
+// analysing a flight would, returning the time it took
+static double load(FlightLogReader& reader, const std::string& fileName, double& checksum)
+{
+    auto start = std::chrono::steady_clock::now();
+    if (!reader.open(fileName))
+        return -1;
+    std::vector<uint64_t> times;
+    std::vector<double> values;
+    checksum = 0;
+    for (size_t i = 0; i < reader.chunks().size(); i++)
+    {
+        reader.readTimes(i, times);
+        size_t channels = reader.streams()[reader.chunks()[i].stream].channels.size();
+        for (size_t c = 0; c < channels; c++)
+        {
+            reader.readChannel(i, c, values);
+            if (!values.empty()) checksum += values.back();
+        }
+    }
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::cerr << "usage: log_convert <log> [flight log]" << std::endl;
+        return 1;
+    }
+    std::string input = argv[1];
+    std::string output;
+    if (argc > 2)
+    {
+        output = argv[2];
+    }
+    else
+    {
+        size_t dot = input.find_last_of('.');
+        size_t slash = input.find_last_of('/');
+        output = input.substr(0, (dot != std::string::npos && (slash == std::string::npos || dot > slash))
+                                 ? dot : input.size()) + ".qflt";
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    const char* data;
+    size_t size;
+    if (!map_file(input, &data, &size))
+        return 1;
+
+    std::vector<Table> tables;
+    uint64_t skipped = 0;
+    bool binary = size >= 8 && memcmp(data, LOG_MAGIC, 8) == 0;
+    if (binary)
+    {
+        read_binary(data, size, tables);
+    }
+    else
+    {
+        read_text(data, size, tables, skipped);
+        choose_encodings(tables);
+    }
+    double parseMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (size > 0)
+        munmap((void*)data, size);
+
+    uint64_t parsed = 0;
+    for (size_t t = 0; t < tables.size(); t++)
+        parsed += tables[t].times.size();
+    if (parsed == 0)
+    {
+        std::cerr << "NO LOG LINES OR RECORDS IN " << input << ", NOTHING WRITTEN" << std::endl;
+        return 1;
+    }
+    if (skipped > parsed)
+        std::cerr << "MOST LINES OF " << input << " ARE NOT LOG LINES: " << skipped << " of "
+                  << skipped + parsed << " skipped" << std::endl;
+
+    uint64_t bytes;
+    if (!write_tables(tables, output, bytes))
+        return 1;
+
+    FlightLogReader reader;
+    double checksum;
+    double loadMs = load(reader, output, checksum);
+    if (loadMs < 0)
+        return 1;
+
+    for (size_t t = 0; t < tables.size(); t++)
+    {
+        printf("  %-28s %8zu rows:", tables[t].name.c_str(), tables[t].times.size());
+        for (size_t c = 0; c < tables[t].channels.size(); c++)
+        {
+            const FlightLogChannel& channel = tables[t].channels[c];
+            if (channel.encoding == FLIGHT_LOG_DELTA)
+                printf(" %s(delta %d)", channel.name.c_str(), channel.decimals);
+            else
+                printf(" %s(float)", channel.name.c_str());
+        }
+        printf("\n");
+    }
+    printf("%s: %s log, %zu bytes, %llu rows, %llu lines skipped, parsed in %.2f ms\n",
+           input.c_str(), binary ? "binary" : "text", size,
+           (unsigned long long)parsed, (unsigned long long)skipped, parseMs);
+    printf("%s: %llu bytes (%.1f%%) in %zu chunks, loaded in %.2f ms (%.1fx faster)\n",
+           output.c_str(), (unsigned long long)bytes, size ? 100.0*bytes/size : 0.0,
+           reader.chunks().size(), loadMs, loadMs > 0 ? parseMs/loadMs : 0.0);
+
+    if (!verify(reader, tables))
+    {
+        std::cerr << "THE FLIGHT LOG DOES NOT READ BACK TO THE LOG" << std::endl;
+        return 1;
+    }
+    return 0;
+}
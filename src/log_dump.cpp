@@ -0,0 +1,119 @@
+/******************************************
+ * log_dump.cpp
+ *
+ * Prints a flight log (see flightLog.h). With
+ * only the file, prints its streams, their
+ * channels and how they are stored; with a
+ * stream, prints its rows as tab separated
+ * text, starting from the chunk the index
+ * gives for the first time asked for.
+ *
+ * usage: log_dump <flight log> [stream [from [to]]]
+ *   from and to are in the log's time, which
+ *   is microseconds, or line numbers for a
+ *   log converted from text
+ ******************************************/
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "flightLog.h"
+
+static void print_schema(const FlightLogReader& reader)
+{
+    const std::vector<FlightLogStream>& streams = reader.streams();
+    for (size_t s = 0; s < streams.size(); s++)
+    {
+        uint64_t first = 0, last = 0;
+        bool any = false;
+        for (size_t i = 0; i < reader.chunks().size(); i++)
+        {
+            const FlightLogChunk& chunk = reader.chunks()[i];
+            if (chunk.stream != s) continue;
+            if (!any || chunk.first_us < first) first = chunk.first_us;
+            if (!any || chunk.last_us > last) last = chunk.last_us;
+            any = true;
+        }
+
+        printf("%s: %llu rows, time %llu to %llu\n", streams[s].name.c_str(),
+               (unsigned long long)reader.rows(s), (unsigned long long)first, (unsigned long long)last);
+        for (size_t c = 0; c < streams[s].channels.size(); c++)
+        {
+            const FlightLogChannel& channel = streams[s].channels[c];
+            if (channel.encoding == FLIGHT_LOG_DELTA)
+                printf("  %s\tdelta, %d decimals\n", channel.name.c_str(), channel.decimals);
+            else
+                printf("  %s\tfloat\n", channel.name.c_str());
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::cerr << "usage: log_dump <flight log> [stream [from [to]]]" << std::endl;
+        return 1;
+    }
+
+    FlightLogReader reader;
+    if (!reader.open(argv[1]))
+        return 1;
+
+    if (argc < 3)
+    {
+        print_schema(reader);
+        return 0;
+    }
+
+    int stream = reader.findStream(argv[2]);
+    if (stream < 0)
+    {
+        std::cerr << "NO STREAM " << argv[2] << " IN " << argv[1] << std::endl;
+        return 1;
+    }
+    uint64_t from = (argc > 3) ? strtoull(argv[3], NULL, 10) : 0;
+    uint64_t to = (argc > 4) ? strtoull(argv[4], NULL, 10) : UINT64_MAX;
+
+    const std::vector<FlightLogChannel>& channels = reader.streams()[stream].channels;
+    printf("time");
+    for (size_t c = 0; c < channels.size(); c++)
+        printf("\t%s", channels[c].name.c_str());
+    printf("\n");
+
+    std::vector<uint64_t> times;
+    std::vector<std::vector<double> > columns(channels.size());
+    const std::vector<FlightLogChunk>& chunks = reader.chunks();
+    for (size_t i = reader.findChunk(stream, from); i < chunks.size(); i++)
+    {
+        if (chunks[i].stream != stream) continue;
+        if (chunks[i].first_us > to) break;
+
+        bool ok = reader.readTimes(i, times);
+        for (size_t c = 0; c < channels.size() && ok; c++)
+            ok = reader.readChannel(i, c, columns[c]);
+        if (!ok)
+        {
+            std::cerr << "COULD NOT DECODE CHUNK " << i << " OF " << argv[1] << std::endl;
+            return 1;
+        }
+
+        for (size_t r = 0; r < times.size(); r++)
+        {
+            if (times[r] < from || times[r] > to) continue;
+            printf("%llu", (unsigned long long)times[r]);
+            for (size_t c = 0; c < channels.size(); c++)
+            {
+                if (channels[c].encoding == FLIGHT_LOG_DELTA)
+                    printf("\t%.*f", channels[c].decimals, columns[c][r]);
+                else
+                    printf("\t%g", columns[c][r]);
+            }
+            printf("\n");
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,233 @@
+#include "logger.h"
+
+#include <iostream>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "spscRing.h"
+
+typedef SpscRing<LogRecord, 1024> LogRing;
+
+struct Logger{
+    FILE* out;
+    bool console;
+    std::atomic<bool> running;
+    std::thread writer;
+
+    // one ring per thread that has logged, never removed while running
+    std::mutex registry;
+    std::vector<LogRing*> rings;
+    std::atomic<uint64_t> dropped;
+    // tells the threads' cached rings from those of an earlier logger
+    unsigned generation;
+};
+
+static std::atomic<Logger*> logger(NULL);
+static unsigned generations = 0;
+
+static uint64_t now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// the rings hold aligned members, which plain new need not respect
+static LogRing* new_ring()
+{
+    void* memory;
+    if (posix_memalign(&memory, SPSC_CACHE_LINE, sizeof(LogRing)) != 0)
+        return NULL;
+    return new (memory) LogRing();
+}
+
+static void delete_ring(LogRing* ring)
+{
+    ring->~LogRing();
+    free(ring);
+}
+
+// write out everything in the rings, returning how many records there were
+static size_t drain(Logger* log)
+{
+    std::vector<LogRing*> rings;
+    {
+        std::lock_guard<std::mutex> guard(log->registry);
+        rings = log->rings;
+    }
+
+    size_t n = 0;
+    LogRecord record;
+    char text[256];
+    for (size_t i = 0; i < rings.size(); i++)
+    {
+        while (rings[i]->pop(record))
+        {
+            if (log->out)
+                fwrite(&record, sizeof(record), 1, log->out);
+            if (log->console)
+            {
+                size_t len = formatLogRecord(record, text, sizeof(text));
+                fwrite(text, 1, len, stdout);
+            }
+            n++;
+        }
+    }
+    return n;
+}
+
+static void run(Logger* log)
+{
+    while (log->running.load())
+    {
+        if (drain(log) == 0)
+        {
+            if (log->out) fflush(log->out);
+            if (log->console) fflush(stdout);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+    drain(log);
+    if (log->out) fflush(log->out);
+    if (log->console) fflush(stdout);
+}
+
+// start writing to fileName, or only to the console if it is empty
+bool startLogger(const std::string& fileName, bool console)
+{
+    if (logger.load())
+        return false;
+
+    Logger* log = new Logger;
+    log->out = NULL;
+    log->console = console;
+    log->dropped = 0;
+    log->generation = ++generations;
+
+    if (!fileName.empty())
+    {
+        log->out = fopen(fileName.c_str(), "wb");
+        if (!log->out)
+        {
+            std::cerr << "COULD NOT OPEN LOG " << fileName << std::endl;
+            delete log;
+            return false;
+        }
+        fwrite(LOG_MAGIC, 1, 8, log->out);
+    }
+
+    log->running = true;
+    log->writer = std::thread(run, log);
+    logger.store(log);
+    return true;
+}
+
+// write what is left and close the log; no thread may still be logging
+void stopLogger()
+{
+    Logger* log = logger.exchange(NULL);
+    if (!log)
+        return;
+
+    log->running = false;
+    log->writer.join();
+    if (log->out) fclose(log->out);
+    for (size_t i = 0; i < log->rings.size(); i++)
+        delete_ring(log->rings[i]);
+    delete log;
+}
+
+// for setting the scheduling of the writer; only valid while running
+pthread_t loggerThread()
+{
+    Logger* log = logger.load();
+    return log ? log->writer.native_handle() : pthread_self();
+}
+
+uint64_t loggerDropped()
+{
+    Logger* log = logger.load();
+    return log ? log->dropped.load() : 0;
+}
+
+// queue a record for the log. A thread's first record sets up its ring,
+// which takes a lock and an allocation; after that nothing waits.
+// Returns false if the record was dropped or no log is running.
+bool logRecord(uint16_t type, float a, float b, float c, float d, float e, float f, uint32_t flags)
+{
+    Logger* log = logger.load();
+    if (!log)
+        return false;
+
+    static thread_local LogRing* ring = NULL;
+    static thread_local unsigned generation = 0;
+    static thread_local uint16_t thread = 0;
+    if (generation != log->generation)
+    {
+        ring = new_ring();
+        if (!ring)
+            return false;
+        std::lock_guard<std::mutex> guard(log->registry);
+        log->rings.push_back(ring);
+        thread = log->rings.size() - 1;
+        generation = log->generation;
+    }
+
+    LogRecord record;
+    record.time_us = now_us();
+    record.type = type;
+    record.thread = thread;
+    record.flags = flags;
+    record.values[0] = a;
+    record.values[1] = b;
+    record.values[2] = c;
+    record.values[3] = d;
+    record.values[4] = e;
+    record.values[5] = f;
+
+    if (!ring->push(record))
+    {
+        log->dropped++;
+        return false;
+    }
+    return true;
+}
+
+// a record as a line of text, in the form fly printed before it logged
+size_t formatLogRecord(const LogRecord& record, char* buf, size_t size)
+{
+    const float* v = record.values;
+    int n;
+    switch (record.type)
+    {
+    case LOG_CONTROL:
+        n = snprintf(buf, size, "Roll: %d\tPitch: %d\tThrottle: %d\t%s\n",
+                     (int)v[0], (int)v[1], (int)v[2], record.flags ? "Switch Flipped" : "");
+        break;
+    case LOG_POSITION:
+        n = snprintf(buf, size, "X: %g cm Y:%g cm Z: %g m\n", v[0], v[1], v[2]);
+        break;
+    case LOG_FLOW:
+        n = snprintf(buf, size, "flow %g %g %g (%d samples)\n", v[0], v[1], v[2], (int)v[3]);
+        break;
+    case LOG_POSE:
+        n = snprintf(buf, size, "pose %g %g %g %g %g %g\n", v[0], v[1], v[2], v[3], v[4], v[5]);
+        break;
+    case LOG_FRAME_READ:
+        n = snprintf(buf, size, "frame read %d us\n", (int)v[0]);
+        break;
+    default:
+        n = snprintf(buf, size, "type %d: %g %g %g %g %g %g\n", record.type, v[0], v[1], v[2], v[3], v[4], v[5]);
+        break;
+    }
+    if (n < 0) return 0;
+    return (size_t)n < size ? n : size - 1;
+}
@@ -0,0 +1,227 @@
+#include "mavlinkParser.h"
+
+// the length and CRC seed of every message we accept; a frame whose
+// id is not here cannot be checked, so its start byte is skipped
+struct MavlinkMessageInfo{
+    uint8_t known;
+    uint8_t len;
+    uint8_t crc_extra;
+};
+
+static MavlinkMessageInfo message_info[256];
+static uint16_t crc_table[256];
+
+// CRC-16/MCRF4XX as MAVLink computes it a bit at a time, one byte per lookup
+static bool build_tables()
+{
+    for (int i = 0; i < 256; i++)
+    {
+        uint8_t tmp = i;
+        tmp ^= (uint8_t)(tmp << 4);
+        crc_table[i] = ((uint16_t)tmp << 8) ^ ((uint16_t)tmp << 3) ^ (tmp >> 4);
+    }
+
+    const uint8_t messages[][3] = {
+        {MAVLINK_ID_HEARTBEAT, 9, 50},
+        {MAVLINK_ID_ATTITUDE, 28, 39},
+        {MAVLINK_ID_OPTICAL_FLOW, 26, 175},
+        {MAVLINK_ID_HIGHRES_IMU, 62, 93},
+        {MAVLINK_ID_OPTICAL_FLOW_RAD, 44, 138},
+    };
+    for (size_t i = 0; i < sizeof(messages)/sizeof(messages[0]); i++)
+    {
+        MavlinkMessageInfo& info = message_info[messages[i][0]];
+        info.known = 1;
+        info.len = messages[i][1];
+        info.crc_extra = messages[i][2];
+    }
+    return true;
+}
+
+static bool tables_built = build_tables();
+
+uint16_t mavlinkCrc(const uint8_t* data, size_t len, uint16_t crc)
+{
+    for (size_t i = 0; i < len; i++)
+        crc = (crc >> 8) ^ crc_table[(crc ^ data[i]) & 0xFF];
+    return crc;
+}
+
+bool mavlinkKnown(uint8_t msgid, uint8_t* len, uint8_t* crc_extra)
+{
+    const MavlinkMessageInfo& info = message_info[msgid];
+    if (len) *len = info.len;
+    if (crc_extra) *crc_extra = info.crc_extra;
+    return info.known;
+}
+
+// write a complete frame to out, which must hold len + 8 bytes
+size_t mavlinkEncode(uint8_t msgid, const void* payload, uint8_t len, uint8_t seq,
+                     uint8_t sysid, uint8_t compid, uint8_t* out)
+{
+    out[0] = MAVLINK_STX;
+    out[1] = len;
+    out[2] = seq;
+    out[3] = sysid;
+    out[4] = compid;
+    out[5] = msgid;
+    memcpy(out + MAVLINK_HEADER_LEN, payload, len);
+
+    uint16_t crc = mavlinkCrc(out + 1, MAVLINK_HEADER_LEN - 1 + len);
+    crc = mavlinkCrc(&message_info[msgid].crc_extra, 1, crc);
+    out[MAVLINK_HEADER_LEN + len] = crc & 0xFF;
+    out[MAVLINK_HEADER_LEN + len + 1] = crc >> 8;
+    return MAVLINK_HEADER_LEN + len + MAVLINK_CHECKSUM_LEN;
+}
+
+MavlinkParser::MavlinkParser()
+{
+    memset(handlers, 0, sizeof(handlers));
+    memset(contexts, 0, sizeof(contexts));
+    memset(&counts, 0, sizeof(counts));
+}
+
+void MavlinkParser::setHandler(uint8_t msgid, MavlinkHandler handler, void* context)
+{
+    handlers[msgid] = handler;
+    contexts[msgid] = context;
+}
+
+// decode every complete frame in the buffer, returning how many bytes
+// were used. The rest is the start of a frame still to come and should
+// be passed again, followed by the bytes read after it.
+size_t MavlinkParser::parse(const uint8_t* data, size_t len)
+{
+    size_t pos = 0;
+
+    while (pos < len)
+    {
+        const uint8_t* start = (const uint8_t*)memchr(data + pos, MAVLINK_STX, len - pos);
+        if (!start)
+        {
+            counts.skipped_bytes += len - pos;
+            return len;
+        }
+        counts.skipped_bytes += start - (data + pos);
+        pos = start - data;
+
+        // wait for the rest of the header
+        if (len - pos < MAVLINK_HEADER_LEN)
+            return pos;
+
+        uint8_t payload_len = start[1];
+        uint8_t msgid = start[5];
+        const MavlinkMessageInfo& info = message_info[msgid];
+        if (!info.known)
+        {
+            counts.unknown++;
+            counts.skipped_bytes++;
+            pos++;
+            continue;
+        }
+        if (payload_len != info.len)
+        {
+            counts.length_errors++;
+            counts.skipped_bytes++;
+            pos++;
+            continue;
+        }
+
+        size_t frame_len = MAVLINK_HEADER_LEN + payload_len + MAVLINK_CHECKSUM_LEN;
+        if (len - pos < frame_len)
+            return pos;
+
+        uint16_t crc = mavlinkCrc(start + 1, MAVLINK_HEADER_LEN - 1 + payload_len);
+        crc = mavlinkCrc(&info.crc_extra, 1, crc);
+        uint16_t sent = start[MAVLINK_HEADER_LEN + payload_len] |
+                        (start[MAVLINK_HEADER_LEN + payload_len + 1] << 8);
+        if (crc != sent)
+        {
+            // a start byte inside a corrupted frame, or a corrupted frame
+            counts.crc_errors++;
+            counts.skipped_bytes++;
+            pos++;
+            continue;
+        }
+
+        counts.frames++;
+        if (handlers[msgid])
+        {
+            MavlinkFrame frame;
+            frame.len = payload_len;
+            frame.seq = start[2];
+            frame.sysid = start[3];
+            frame.compid = start[4];
+            frame.msgid = msgid;
+            frame.payload = start + MAVLINK_HEADER_LEN;
+            handlers[msgid](frame, contexts[msgid]);
+        }
+        pos += frame_len;
+    }
+
+    return pos;
+}
+
+// the payload offsets are those of the MAVLink v1 wire format, where
+// fields are sorted by size; received_usec is left to the caller
+void mavlinkDecode(const MavlinkFrame& frame, MavlinkOpticalFlow& msg)
+{
+    const uint8_t* p = frame.payload;
+    msg.time_usec = mavlinkField<uint64_t>(p, 0);
+    msg.flow_comp_m_x = mavlinkField<float>(p, 8);
+    msg.flow_comp_m_y = mavlinkField<float>(p, 12);
+    msg.ground_distance = mavlinkField<float>(p, 16);
+    msg.flow_x = mavlinkField<int16_t>(p, 20);
+    msg.flow_y = mavlinkField<int16_t>(p, 22);
+    msg.sensor_id = p[24];
+    msg.quality = p[25];
+}
+
+void mavlinkDecode(const MavlinkFrame& frame, MavlinkOpticalFlowRad& msg)
+{
+    const uint8_t* p = frame.payload;
+    msg.time_usec = mavlinkField<uint64_t>(p, 0);
+    msg.integration_time_us = mavlinkField<uint32_t>(p, 8);
+    msg.integrated_x = mavlinkField<float>(p, 12);
+    msg.integrated_y = mavlinkField<float>(p, 16);
+    msg.integrated_xgyro = mavlinkField<float>(p, 20);
+    msg.integrated_ygyro = mavlinkField<float>(p, 24);
+    msg.integrated_zgyro = mavlinkField<float>(p, 28);
+    msg.time_delta_distance_us = mavlinkField<uint32_t>(p, 32);
+    msg.distance = mavlinkField<float>(p, 36);
+    msg.temperature = mavlinkField<int16_t>(p, 40);
+    msg.sensor_id = p[42];
+    msg.quality = p[43];
+}
+
+void mavlinkDecode(const MavlinkFrame& frame, MavlinkHighresImu& msg)
+{
+    const uint8_t* p = frame.payload;
+    msg.time_usec = mavlinkField<uint64_t>(p, 0);
+    msg.xacc = mavlinkField<float>(p, 8);
+    msg.yacc = mavlinkField<float>(p, 12);
+    msg.zacc = mavlinkField<float>(p, 16);
+    msg.xgyro = mavlinkField<float>(p, 20);
+    msg.ygyro = mavlinkField<float>(p, 24);
+    msg.zgyro = mavlinkField<float>(p, 28);
+    msg.xmag = mavlinkField<float>(p, 32);
+    msg.ymag = mavlinkField<float>(p, 36);
+    msg.zmag = mavlinkField<float>(p, 40);
+    msg.abs_pressure = mavlinkField<float>(p, 44);
+    msg.diff_pressure = mavlinkField<float>(p, 48);
+    msg.pressure_alt = mavlinkField<float>(p, 52);
+    msg.temperature = mavlinkField<float>(p, 56);
+    msg.fields_updated = mavlinkField<uint16_t>(p, 60);
+}
+
+void mavlinkDecode(const MavlinkFrame& frame, MavlinkAttitude& msg)
+{
+    const uint8_t* p = frame.payload;
+    msg.time_boot_ms = mavlinkField<uint32_t>(p, 0);
+    msg.roll = mavlinkField<float>(p, 4);
+    msg.pitch = mavlinkField<float>(p, 8);
+    msg.yaw = mavlinkField<float>(p, 12);
+    msg.rollspeed = mavlinkField<float>(p, 16);
+    msg.pitchspeed = mavlinkField<float>(p, 20);
+    msg.yawspeed = mavlinkField<float>(p, 24);
+}
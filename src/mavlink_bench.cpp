@@ -0,0 +1,186 @@
+/******************************************
+ * mavlink_bench.cpp
+ *
+ * Measures how fast MavlinkParser decodes a
+ * stream of flow sensor bytes, against the
+ * byte at a time mavlink_parse_char. On a
+ * clean stream both find every frame; on a
+ * damaged one MavlinkParser may find a few
+ * more, as it rescans the bytes of a frame
+ * that fails its CRC for the next start.
+ *
+ * The stream is read from a file recorded
+ * from the sensor, for example with
+ *   cat /dev/ttyACM0 > tmp/flow.bin
+ * or made up of flow, IMU, attitude and
+ * heartbeat frames. Some bytes are then
+ * flipped and some frames cut short, and the
+ * stream is fed in reads of random size, so
+ * frames split across reads are exercised.
+ *
+ * usage: mavlink_bench [stream file or -] [corrupted fraction]
+ ******************************************/
+
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include <chrono>
+#include <stdlib.h>
+#include <string.h>
+
+#include <mavlink/common/mavlink.h>
+
+#include "mavlinkParser.h"
+
+static void count_frame(const MavlinkFrame&, void* context)
+{
+    (*(uint64_t*)context)++;
+}
+
+// a stream of frames in the mix the sensor sends them
+static std::vector<uint8_t> make_stream(size_t frames)
+{
+    const uint8_t ids[] = {MAVLINK_ID_OPTICAL_FLOW, MAVLINK_ID_OPTICAL_FLOW, MAVLINK_ID_OPTICAL_FLOW_RAD,
+                           MAVLINK_ID_HIGHRES_IMU, MAVLINK_ID_HIGHRES_IMU, MAVLINK_ID_ATTITUDE,
+                           MAVLINK_ID_OPTICAL_FLOW, MAVLINK_ID_HEARTBEAT};
+    std::vector<uint8_t> stream;
+    uint8_t payload[255];
+    uint8_t frame[MAVLINK_MAX_FRAME_LEN];
+
+    for (size_t i = 0; i < frames; i++)
+    {
+        uint8_t id = ids[i % sizeof(ids)];
+        uint8_t len;
+        mavlinkKnown(id, &len, NULL);
+        for (int j = 0; j < len; j++)
+            payload[j] = rand();
+        size_t n = mavlinkEncode(id, payload, len, i, 81, 50, frame);
+        stream.insert(stream.end(), frame, frame + n);
+    }
+    return stream;
+}
+
+// flip bytes and drop the ends of frames
+static void corrupt(std::vector<uint8_t>& stream, double fraction)
+{
+    size_t damaged = stream.size() * fraction / 40;
+    for (size_t i = 0; i < damaged; i++)
+    {
+        size_t at = rand() % stream.size();
+        if (i % 2 == 0)
+        {
+            stream[at] ^= 1 << (rand() % 8);
+        }
+        else
+        {
+            size_t cut = 1 + rand() % 30;
+            if (at + cut < stream.size())
+                stream.erase(stream.begin() + at, stream.begin() + at + cut);
+        }
+    }
+}
+
+// the sizes of the reads the stream arrives in
+static std::vector<size_t> make_reads(size_t total)
+{
+    std::vector<size_t> reads;
+    while (total > 0)
+    {
+        size_t n = std::min(total, (size_t)(1 + rand() % 512));
+        reads.push_back(n);
+        total -= n;
+    }
+    return reads;
+}
+
+static uint64_t run_parser(const std::vector<uint8_t>& stream, const std::vector<size_t>& reads, MavlinkStats& stats)
+{
+    uint64_t frames = 0;
+    MavlinkParser parser;
+    for (int id = 0; id < 256; id++)
+        parser.setHandler(id, count_frame, &frames);
+
+    // as the sensor loop does it: append, parse, keep the partial frame
+    uint8_t rx[4096];
+    size_t rx_len = 0;
+    size_t pos = 0;
+    for (size_t r = 0; r < reads.size(); r++)
+    {
+        memcpy(rx + rx_len, &stream[pos], reads[r]);
+        rx_len += reads[r];
+        pos += reads[r];
+
+        size_t used = parser.parse(rx, rx_len);
+        memmove(rx, rx + used, rx_len - used);
+        rx_len -= used;
+    }
+    stats = parser.stats();
+    return frames;
+}
+
+static uint64_t run_parse_char(const std::vector<uint8_t>& stream)
+{
+    uint64_t frames = 0;
+    mavlink_message_t msg;
+    mavlink_status_t status;
+    memset(&status, 0, sizeof(status));
+    for (size_t i = 0; i < stream.size(); i++)
+    {
+        if (mavlink_parse_char(0, stream[i], &msg, &status))
+            frames++;
+    }
+    return frames;
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<uint8_t> stream;
+    if (argc > 1 && strcmp(argv[1], "-") != 0)
+    {
+        std::ifstream in(argv[1], std::ios::binary);
+        if (!in)
+        {
+            std::cerr << "COULD NOT OPEN " << argv[1] << std::endl;
+            return 1;
+        }
+        stream.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    else
+    {
+        stream = make_stream(200000);
+    }
+    if (stream.empty())
+    {
+        std::cerr << "THE STREAM IS EMPTY" << std::endl;
+        return 1;
+    }
+    double fraction = (argc > 2)? atof(argv[2]) : 0.01;
+
+    srand(1);
+    corrupt(stream, fraction);
+    std::vector<size_t> reads = make_reads(stream.size());
+    const int passes = 10;
+
+    MavlinkStats stats;
+    uint64_t frames = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int p = 0; p < passes; p++)
+        frames = run_parser(stream, reads, stats);
+    double parserTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    uint64_t baseFrames = 0;
+    start = std::chrono::steady_clock::now();
+    for (int p = 0; p < passes; p++)
+        baseFrames = run_parse_char(stream);
+    double baseTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    double mb = (double)stream.size() * passes / (1 << 20);
+    std::cout << stream.size() << " bytes in " << reads.size() << " reads" << std::endl;
+    std::cout << "MavlinkParser:      " << mb/parserTime << " MB/s, " << frames << " frames, "
+              << stats.crc_errors << " CRC errors, " << stats.length_errors << " length errors, "
+              << stats.unknown << " unknown, " << stats.skipped_bytes << " bytes skipped" << std::endl;
+    std::cout << "mavlink_parse_char: " << mb/baseTime << " MB/s, " << baseFrames << " frames" << std::endl;
+    std::cout << "speedup " << baseTime/parserTime << "x" << std::endl;
+    return 0;
+}
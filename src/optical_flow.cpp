@@ -1,6 +1,5 @@
 #include "optical_flow.h"
 
-#include <mavlink/common/mavlink.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -9,59 +8,261 @@
 #include <signal.h>
 #include <stdlib.h>
 #include <string>
-#include <queue>
 #include <thread>
 #include <chrono>
 #include <iostream>
+#include <algorithm>
+#include <string.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+OpticalFlowSensor::OpticalFlowSensor()
+{
+    memset(&totals, 0, sizeof(totals));
+    memset(&shared_totals, 0, sizeof(shared_totals));
+    memset(&drained, 0, sizeof(drained));
+    totals_sequence.store(0);
+
+    event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event_fd < 0)
+        std::cerr << "COULD NOT CREATE THE FLOW EVENTFD" << std::endl;
+}
+
+// readable once samples have arrived; read it to clear it
+int OpticalFlowSensor::eventFd()
+{
+    return event_fd;
+}
 
 bool OpticalFlowSensor::dataReady()
 {
-    return ready.load();
+    return !data_points.empty();
 }
 
+// the oldest sample not yet taken, or no flow if there is none
 FlowData OpticalFlowSensor::getFlowData()
 {
-    data_points_mutex.lock();
-    FlowData ret_val = data_points.front();
-    data_points.pop();
-    if (data_points.empty())
-        ready.store(false);
-    data_points_mutex.unlock();
-
+    FlowData ret_val(0, 0, 0);
+    data_points.pop(ret_val);
     return ret_val;
 }
 
-void OpticalFlowSensor::loop(std::string device_file)
+uint64_t OpticalFlowSensor::droppedSamples()
+{
+    return data_points.overflows();
+}
+
+// add up the flow of every sample since the last call, however many
+// arrived. Samples still queued for getFlowData are dropped, as they
+// are already counted here, so use one or the other. Returns false if
+// nothing new arrived.
+bool OpticalFlowSensor::drainFlow(FlowIntegral& integral)
+{
+    FlowTotals now;
+    for (;;)
+    {
+        uint32_t before = totals_sequence.load(std::memory_order_acquire);
+        if (before & 1) continue;
+
+        memcpy(&now, (const void*)&shared_totals, sizeof(FlowTotals));
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (totals_sequence.load(std::memory_order_relaxed) == before)
+            break;
+    }
+
+    FlowData discarded;
+    for (size_t n = data_points.size(); n > 0 && data_points.pop(discarded); n--);
+
+    if (now.count == drained.count)
+        return false;
+
+    uint64_t since = (drained.count > 0) ? drained.last_usec : now.first_usec;
+    integral.dx = (now.x - now.x_comp) - (drained.x - drained.x_comp);
+    integral.dy = (now.y - now.y_comp) - (drained.y - drained.y_comp);
+    integral.samples = now.count - drained.count;
+    integral.timespan = (now.last_usec - since) * 1e-6f;
+    integral.ground_distance = now.ground_distance;
+
+    drained = now;
+    return true;
+}
+
+bool OpticalFlowSensor::getFlowMessage(MavlinkOpticalFlow& msg)
+{
+    return flow_messages.pop(msg);
+}
+
+bool OpticalFlowSensor::getFlowRad(MavlinkOpticalFlowRad& msg)
+{
+    return flow_rad_messages.pop(msg);
+}
+
+bool OpticalFlowSensor::getImu(MavlinkHighresImu& msg)
+{
+    return imu_messages.pop(msg);
+}
+
+bool OpticalFlowSensor::getAttitude(MavlinkAttitude& msg)
+{
+    return attitude_messages.pop(msg);
+}
+
+static void kahan_add(double& sum, double& comp, double value)
 {
-    char buf[10];
-    mavlink_message_t msg;
-    mavlink_status_t status;
+    double y = value - comp;
+    double t = sum + y;
+    comp = (t - sum) - y;
+    sum = t;
+}
+
+// open and configure the serial device, retrying until it appears
+int OpticalFlowSensor::open_device(const std::string& device_file)
+{
+    for (;;)
+    {
+        int dev = open(device_file.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+        if (dev >= 0)
+        {
+            if (set_interface_attribs(dev, B115200, 0) == 0)
+                return dev;
+            std::cerr << "COULD NOT CONFIGURE " << device_file << std::endl;
+            close(dev);
+        }
+        else
+        {
+            std::cerr << "COULD NOT OPEN " << device_file << ": " << strerror(errno) << std::endl;
+        }
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+}
+
+// read what the port has into the free end of the buffer. Returns
+// the result of read.
+ssize_t OpticalFlowSensor::fill_buffer()
+{
+    ssize_t n = read(fd, rx + rx_len, RX_SIZE - rx_len);
+    if (n > 0)
+        rx_len += n;
+    return n;
+}
+
+void OpticalFlowSensor::on_optical_flow(const MavlinkFrame& frame, void* context)
+{
+    OpticalFlowSensor* sensor = (OpticalFlowSensor*)context;
+    MavlinkOpticalFlow msg;
+    mavlinkDecode(frame, msg);
+    msg.received_usec = sensor->rx_time_usec;
+    sensor->flow_messages.push(msg);
+
+    float flow_x = msg.flow_comp_m_x;
+    float flow_y = msg.flow_comp_m_y;
+    float ground_distance = msg.ground_distance;
+    sensor->data_points.push(FlowData(flow_x, flow_y, ground_distance));
 
+    FlowTotals& totals = sensor->totals;
+    kahan_add(totals.x, totals.x_comp, flow_x);
+    kahan_add(totals.y, totals.y_comp, flow_y);
+    totals.last_usec = msg.time_usec;
+    if (totals.count == 0)
+        totals.first_usec = totals.last_usec;
+    totals.count++;
+    totals.ground_distance = ground_distance;
+
+    // publish for drainFlow, as StatePublisher does
+    uint32_t seq = sensor->totals_sequence.load(std::memory_order_relaxed);
+    sensor->totals_sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(&sensor->shared_totals, &totals, sizeof(FlowTotals));
+    sensor->totals_sequence.store(seq + 2, std::memory_order_release);
+}
+
+void OpticalFlowSensor::on_optical_flow_rad(const MavlinkFrame& frame, void* context)
+{
+    OpticalFlowSensor* sensor = (OpticalFlowSensor*)context;
+    MavlinkOpticalFlowRad msg;
+    mavlinkDecode(frame, msg);
+    msg.received_usec = sensor->rx_time_usec;
+    sensor->flow_rad_messages.push(msg);
+}
+
+void OpticalFlowSensor::on_highres_imu(const MavlinkFrame& frame, void* context)
+{
+    OpticalFlowSensor* sensor = (OpticalFlowSensor*)context;
+    MavlinkHighresImu msg;
+    mavlinkDecode(frame, msg);
+    msg.received_usec = sensor->rx_time_usec;
+    sensor->imu_messages.push(msg);
+}
+
+void OpticalFlowSensor::on_attitude(const MavlinkFrame& frame, void* context)
+{
+    OpticalFlowSensor* sensor = (OpticalFlowSensor*)context;
+    MavlinkAttitude msg;
+    mavlinkDecode(frame, msg);
+    msg.received_usec = sensor->rx_time_usec;
+    sensor->attitude_messages.push(msg);
+}
+
+void OpticalFlowSensor::loop(std::string device_file)
+{
     //signal(SIGINT, sig_handler);    
 
-    fd = open(device_file.c_str(), O_RDWR | O_SYNC | O_NOCTTY);
-    set_interface_attribs(fd, B115200, 0);
+    // looked up by msgid in a table, so more kinds cost the flow path nothing
+    parser.setHandler(MAVLINK_ID_OPTICAL_FLOW, on_optical_flow, this);
+    parser.setHandler(MAVLINK_ID_OPTICAL_FLOW_RAD, on_optical_flow_rad, this);
+    parser.setHandler(MAVLINK_ID_HIGHRES_IMU, on_highres_imu, this);
+    parser.setHandler(MAVLINK_ID_ATTITUDE, on_attitude, this);
+
+    fd = open_device(device_file);
+    rx_len = 0;
 
-    float flow_x = 0;
-    float flow_y = 0;
-    float ground_distance = 0;    
-    
     while (1)
     {
-        read(fd, buf, 1);
+        // sleep until bytes arrive instead of polling the port
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        int ready_fds = poll(&pfd, 1, 1000);
+        if (ready_fds < 0 && errno != EINTR)
+        {
+            std::cerr << "POLL FAILED ON " << device_file << ": " << strerror(errno) << std::endl;
+        }
+        if (ready_fds <= 0)
+            continue;
+
+        ssize_t n = 0;
+        if (pfd.revents & POLLIN)
+            n = fill_buffer();
 
-        if (mavlink_parse_char(0, buf[0], &msg, &status))
+        bool lost = (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) ||
+                    (n == 0 && (pfd.revents & POLLIN)) ||
+                    (n < 0 && errno != EAGAIN && errno != EINTR);
+        if (lost)
         {
-            flow_x = mavlink_msg_optical_flow_get_flow_comp_m_x(&msg);
-            flow_y = mavlink_msg_optical_flow_get_flow_comp_m_y(&msg);
-            ground_distance = mavlink_msg_optical_flow_get_ground_distance(&msg);
-            data_points_mutex.lock();
-            data_points.push(FlowData(flow_x, flow_y, ground_distance));
-            ready.store(true);
-            data_points_mutex.unlock();
-                	
-	    }
-	}
+            // unplugged or failed; the parser resyncs on the next frame
+            std::cerr << "LOST " << device_file << ", RECONNECTING" << std::endl;
+            close(fd);
+            fd = open_device(device_file);
+            rx_len = 0;
+            continue;
+        }
+
+        // decode every whole frame at once and keep the partial one
+        rx_time_usec = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        uint64_t frames = parser.stats().frames;
+        size_t used = parser.parse(rx, rx_len);
+        memmove(rx, rx + used, rx_len - used);
+        rx_len -= used;
+
+        // one wakeup for the whole read, however many frames it held
+        if (parser.stats().frames != frames && event_fd >= 0)
+        {
+            uint64_t one = 1;
+            write(event_fd, &one, sizeof(one));
+        }
+    }
 }
 
 
@@ -85,10 +286,12 @@ int OpticalFlowSensor::set_interface_attribs (int fd, int speed, int parity)
     tty.c_lflag = 0;                // no signaling chars, no echo,
     // no canonical processing
     tty.c_oflag = 0;                // no remapping, no delays
-    tty.c_cc[VMIN]  = 0;            // read doesn't block
-    tty.c_cc[VTIME] = 5;            // 0.5 seconds read timeout
+    tty.c_cc[VMIN]  = 0;            // read returns what is there,
+    tty.c_cc[VTIME] = 0;            // poll does the waiting
 
     tty.c_iflag &= ~(IXON | IXOFF | IXANY); // shut off xon/xoff ctrl
+    tty.c_iflag &= ~(ICRNL | INLCR | IGNCR | ISTRIP | PARMRK); // pass every
+    // byte through as sent, 0x0d and 0x0a included
 
     tty.c_cflag |= (CLOCAL | CREAD);// ignore modem controls,
     // enable reading
@@ -0,0 +1,151 @@
+#include "pwmOutput.h"
+
+#include <iostream>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+static int64_t now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// decimal digits of value at the end of buf, returning where they start
+static char* format_int(int value, char* end)
+{
+    char* p = end;
+    bool negative = value < 0;
+    unsigned int v = negative ? -(unsigned int)value : value;
+    do
+    {
+        *--p = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    if (negative) *--p = '-';
+    return p;
+}
+
+PwmOutput::PwmOutput(const std::string devices[PWM_CHANNELS])
+    : write_count(0), failure_count(0), latency_us(5, 400)
+{
+    for (int i = 0; i < PWM_CHANNELS; i++)
+    {
+        Channel& c = channels[i];
+        c.device = devices[i];
+        c.fd = -1;
+        c.value = -1;
+        c.written = -1;
+        c.regular = false;
+        c.seekable = true;
+        c.failing = false;
+        if (c.device.empty())
+            continue;
+
+        c.fd = open(c.device.c_str(), O_WRONLY | O_CLOEXEC);
+        if (c.fd < 0)
+        {
+            std::cerr << "COULD NOT OPEN PWM " << c.device << ": " << strerror(errno) << std::endl;
+            continue;
+        }
+        struct stat st;
+        c.regular = fstat(c.fd, &st) == 0 && S_ISREG(st.st_mode);
+    }
+}
+
+PwmOutput::~PwmOutput()
+{
+    for (int i = 0; i < PWM_CHANNELS; i++)
+    {
+        if (channels[i].fd >= 0) close(channels[i].fd);
+    }
+}
+
+bool PwmOutput::isOpen(int channel)
+{
+    return channels[channel].fd >= 0;
+}
+
+// the value to send on the next write
+void PwmOutput::set(int channel, int value)
+{
+    channels[channel].value = value;
+}
+
+// send every value that changed since the last write, returning how
+// many were sent. The time taken goes into the latency histogram.
+int PwmOutput::write()
+{
+    int64_t start = now_us();
+    int sent = 0;
+
+    for (int i = 0; i < PWM_CHANNELS; i++)
+    {
+        Channel& c = channels[i];
+        if (c.fd < 0 || c.value < 0 || c.value == c.written)
+            continue;
+
+        char buf[16];
+        char* end = buf + sizeof(buf);
+        char* text = format_int(c.value, end);
+        size_t len = end - text;
+
+        ssize_t n;
+        if (c.seekable)
+        {
+            n = pwrite(c.fd, text, len, 0);
+            if (n < 0 && errno == ESPIPE)
+            {
+                c.seekable = false;
+                n = ::write(c.fd, text, len);
+            }
+        }
+        else
+        {
+            n = ::write(c.fd, text, len);
+        }
+
+        if (n != (ssize_t)len)
+        {
+            if (!c.failing)
+                std::cerr << "PWM WRITE TO " << c.device << " FAILED: " << strerror(errno) << std::endl;
+            c.failing = true;
+            failure_count++;
+            continue;
+        }
+        if (c.failing)
+            std::cerr << "PWM WRITE TO " << c.device << " RECOVERED" << std::endl;
+        c.failing = false;
+        // a shorter number must not leave digits of the last behind
+        if (c.regular && ftruncate(c.fd, len) < 0)
+            std::cerr << "COULD NOT TRUNCATE " << c.device << std::endl;
+
+        c.written = c.value;
+        sent++;
+    }
+
+    write_count += sent;
+    latency_us.record(now_us() - start);
+    return sent;
+}
+
+// values actually sent, over all channels
+uint64_t PwmOutput::writes()
+{
+    return write_count;
+}
+
+// writes that failed, over all channels
+uint64_t PwmOutput::failures()
+{
+    return failure_count;
+}
+
+const Histogram& PwmOutput::latency()
+{
+    return latency_us;
+}
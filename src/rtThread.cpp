@@ -0,0 +1,83 @@
+#include "rtThread.h"
+
+#include <iostream>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <alloca.h>
+#include <sys/mman.h>
+
+static int policy_of(const std::string& name)
+{
+    if (name == "fifo") return SCHED_FIFO;
+    if (name == "rr") return SCHED_RR;
+    if (name == "batch") return SCHED_BATCH;
+    if (name == "idle") return SCHED_IDLE;
+    return SCHED_OTHER;
+}
+
+// set the policy, priority and core of a thread. Each part that fails
+// is reported and skipped; returns true only if everything was applied.
+bool applyThreadConfig(pthread_t thread, const ThreadConfig& config, const char* role)
+{
+    bool applied = true;
+
+    int policy = policy_of(config.policy);
+    if (policy == SCHED_OTHER && config.policy != "other")
+        std::cerr << "UNKNOWN SCHEDULING POLICY " << config.policy << " FOR " << role << std::endl;
+
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    if (policy == SCHED_FIFO || policy == SCHED_RR)
+    {
+        int low = sched_get_priority_min(policy), high = sched_get_priority_max(policy);
+        param.sched_priority = config.priority < low ? low : (config.priority > high ? high : config.priority);
+    }
+
+    int err = pthread_setschedparam(thread, policy, &param);
+    if (err != 0)
+    {
+        std::cerr << "COULD NOT SET " << config.policy << " SCHEDULING FOR " << role << ": " << strerror(err)
+                  << (err == EPERM ? ", RUNNING WITH NORMAL SCHEDULING" : "") << std::endl;
+        applied = false;
+    }
+
+    if (config.core >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(config.core, &set);
+        err = pthread_setaffinity_np(thread, sizeof(set), &set);
+        if (err != 0)
+        {
+            std::cerr << "COULD NOT PIN " << role << " TO CORE " << config.core << ": " << strerror(err) << std::endl;
+            applied = false;
+        }
+    }
+
+    return applied;
+}
+
+// keep every page of the process, and every page mapped later such as
+// the stacks of threads started afterwards, in memory, so a page fault
+// never stalls the control loop. Call before starting threads.
+bool lockMemory()
+{
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+    {
+        std::cerr << "COULD NOT LOCK MEMORY: " << strerror(errno)
+                  << (errno == EPERM || errno == ENOMEM ? ", PAGE FAULTS MAY DELAY THE CONTROL LOOP" : "")
+                  << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// touch the next bytes of the calling thread's stack so they are
+// mapped before the thread has to run on time
+void prefaultStack(size_t bytes)
+{
+    volatile unsigned char* stack = (volatile unsigned char*)alloca(bytes);
+    for (size_t i = 0; i < bytes; i += 4096)
+        stack[i] = 0;
+}
@@ -0,0 +1,152 @@
+#include "sharedState.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <iostream>
+
+static const uint32_t SHARED_STATE_MAGIC = 0x464c5931; // "FLY1"
+
+// an update takes well under a microsecond, so a reader that still
+// sees one in progress after this long has a writer that died in it
+static const int READ_SPINS = 1000;
+static const int64_t READ_TIMEOUT_NS = 10000000;
+
+static int64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+StatePublisher::StatePublisher(const std::string& name)
+    : name(name), segment(NULL)
+{
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd < 0)
+    {
+        std::cerr << "COULD NOT OPEN SHARED STATE " << name << std::endl;
+        return;
+    }
+
+    if (ftruncate(fd, sizeof(SharedStateSegment)) < 0)
+    {
+        std::cerr << "COULD NOT SIZE SHARED STATE " << name << std::endl;
+        close(fd);
+        return;
+    }
+
+    void* addr = mmap(NULL, sizeof(SharedStateSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+    {
+        std::cerr << "COULD NOT MAP SHARED STATE " << name << std::endl;
+        return;
+    }
+
+    segment = (SharedStateSegment*)addr;
+    segment->sequence.store(0);
+    memset(&segment->state, 0, sizeof(FlyState));
+    segment->size = sizeof(SharedStateSegment);
+    segment->magic = SHARED_STATE_MAGIC;
+}
+
+StatePublisher::~StatePublisher()
+{
+    if (segment)
+    {
+        munmap(segment, sizeof(SharedStateSegment));
+        shm_unlink(name.c_str());
+    }
+}
+
+bool StatePublisher::isOpen()
+{
+    return segment != NULL;
+}
+
+void StatePublisher::publish(const FlyState& state)
+{
+    if (!segment) return;
+
+    uint32_t seq = segment->sequence.load(std::memory_order_relaxed);
+    segment->sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    memcpy(&segment->state, &state, sizeof(FlyState));
+
+    segment->sequence.store(seq + 2, std::memory_order_release);
+}
+
+StateReader::StateReader(const std::string& name)
+    : segment(NULL)
+{
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+    {
+        std::cerr << "COULD NOT OPEN SHARED STATE " << name << ", IS FLY RUNNING?" << std::endl;
+        return;
+    }
+
+    void* addr = mmap(NULL, sizeof(SharedStateSegment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+    {
+        std::cerr << "COULD NOT MAP SHARED STATE " << name << std::endl;
+        return;
+    }
+
+    segment = (const SharedStateSegment*)addr;
+    if (segment->magic != SHARED_STATE_MAGIC || segment->size != sizeof(SharedStateSegment))
+    {
+        std::cerr << "SHARED STATE " << name << " IS FROM ANOTHER VERSION OF FLY" << std::endl;
+        munmap((void*)segment, sizeof(SharedStateSegment));
+        segment = NULL;
+    }
+}
+
+StateReader::~StateReader()
+{
+    if (segment) munmap((void*)segment, sizeof(SharedStateSegment));
+}
+
+bool StateReader::isOpen()
+{
+    return segment != NULL;
+}
+
+// copy out the state, retrying while the writer is part way through
+// an update. Returns false if no state has been published yet, or if
+// an update has not finished within READ_TIMEOUT_NS, as when fly dies
+// in the middle of one.
+bool StateReader::read(FlyState& state)
+{
+    if (!segment) return false;
+
+    int64_t deadline = 0;
+    for (int tries = 0; ; tries++)
+    {
+        // spin briefly, then yield the CPU to the writer between tries
+        if (tries >= READ_SPINS)
+        {
+            if (deadline == 0)
+                deadline = now_ns() + READ_TIMEOUT_NS;
+            else if (now_ns() > deadline)
+                return false;
+            sched_yield();
+        }
+
+        uint32_t before = segment->sequence.load(std::memory_order_acquire);
+        if (before & 1) continue;
+
+        memcpy(&state, (const void*)&segment->state, sizeof(FlyState));
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        uint32_t after = segment->sequence.load(std::memory_order_relaxed);
+        if (before == after) return before != 0;
+    }
+}
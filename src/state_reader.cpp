@@ -0,0 +1,48 @@
+/******************************************
+ * state_reader.cpp
+ *
+ * Prints the state fly publishes in shared
+ * memory, as an example of reading it.
+ *
+ * usage: state_reader [rate in Hz]
+ ******************************************/
+
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <chrono>
+#include <stdlib.h>
+
+#include "sharedState.h"
+
+int main(int argc, char** argv)
+{
+    float rate = (argc > 1)? atof(argv[1]) : 10;
+    if (rate <= 0) rate = 10;
+
+    StateReader reader;
+    if (!reader.isOpen())
+        return 1;
+
+    uint64_t lastUpdates = 0;
+    for (;;)
+    {
+        FlyState state;
+        if (reader.read(state) && state.updates != lastUpdates)
+        {
+            lastUpdates = state.updates;
+            std::cout << std::fixed << std::setprecision(2)
+                      << "t " << state.time_us/1000 << " ms"
+                      << "  pose [" << state.x << ", " << state.y << ", " << state.z << ", "
+                      << state.psi << ", " << state.theta << ", " << state.phi << "]"
+                      << "  flow [" << state.flow_x << ", " << state.flow_y << ", " << state.ground_distance << "]"
+                      << "  set [" << state.setPointX << ", " << state.setPointY << ", " << state.setPointZ << "]"
+                      << "  pwm R " << state.pwmRoll << " P " << state.pwmPitch
+                      << " T " << state.pwmThrottle << " Y " << state.pwmYaw
+                      << (state.inFlight? "  in flight" : "")
+                      << std::endl;
+        }
+
+        std::this_thread::sleep_for(std::chrono::microseconds((long)(1e6/rate)));
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+/*
+  The checks of the programs under test/. A failed check prints where
+  it is and what failed and the program carries on, so one run shows
+  every failure; checkResult gives the exit status for make check.
+*/
+
+#include <iostream>
+#include <cmath>
+
+static int checkFailures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) \
+        { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK FAILED: " #condition << std::endl; \
+            checkFailures++; \
+        } \
+    } while (0)
+
+#define CHECK_NEAR(a, b, tolerance) \
+    do { \
+        double checkA = (a), checkB = (b); \
+        if (!(std::fabs(checkA - checkB) <= (tolerance))) \
+        { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK FAILED: " #a " is " << checkA \
+                      << ", expected " << checkB << std::endl; \
+            checkFailures++; \
+        } \
+    } while (0)
+
+static int checkResult(const char* name)
+{
+    if (checkFailures)
+        std::cerr << name << ": " << checkFailures << " checks failed" << std::endl;
+    else
+        std::cout << name << ": ok" << std::endl;
+    return checkFailures != 0;
+}
+
+#endif
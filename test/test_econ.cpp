@@ -0,0 +1,246 @@
+/******************************************
+ * test_econ.cpp
+ *
+ * Checks switching the capture mode of the
+ * econ camera and rescaling the calibration
+ * to the new mode, without the camera. The
+ * ioctls econ.h makes are answered by a fake
+ * V4L2 driver, which can leave out the
+ * selection API, as older drivers do, and
+ * round frame widths, as real ones do.
+ *
+ * usage: test_econ
+ ******************************************/
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <stdarg.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/videodev2.h>
+
+#include "opencv2/core/core.hpp"
+#include "logger.h"
+#include "config.h"
+#include "check.h"
+
+struct FakeDriver {
+  // answers the selection ioctls; without them only S_CROP works
+  bool selection;
+  // frame widths are rounded down to a multiple of this
+  int widthStep;
+  struct v4l2_format fmt;
+  struct v4l2_rect crop;
+  std::vector<unsigned long> calls;
+};
+
+static FakeDriver driver;
+
+static void resetDriver(bool selection, int widthStep) {
+  driver.selection = selection;
+  driver.widthStep = widthStep;
+  memset(&driver.fmt, 0, sizeof(driver.fmt));
+  driver.fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  driver.fmt.fmt.pix.width = 1600;
+  driver.fmt.fmt.pix.height = 1200;
+  driver.crop.left = 0;
+  driver.crop.top = 0;
+  driver.crop.width = 1600;
+  driver.crop.height = 1200;
+  driver.calls.clear();
+}
+
+static int calls(unsigned long request) {
+  return std::count(driver.calls.begin(), driver.calls.end(), request);
+}
+
+// econ.h opens /dev/videoN itself, and also has an ofstream member
+// called open, so the device is swapped for /dev/null here rather
+// than with a macro
+extern "C" int open(const char* path, int flags, ...) {
+  mode_t mode = 0;
+  if(flags & O_CREAT) {
+    va_list args;
+    va_start(args, flags);
+    mode = va_arg(args, mode_t);
+    va_end(args);
+  }
+  if(strncmp(path, "/dev/video", 10) == 0)
+    path = "/dev/null";
+  return syscall(SYS_openat, AT_FDCWD, path, flags, mode);
+}
+
+static int fake_ioctl(int, unsigned long request, ...) {
+  va_list args;
+  va_start(args, request);
+  void* arg = va_arg(args, void*);
+  va_end(args);
+  driver.calls.push_back(request);
+
+  switch(request) {
+  case VIDIOC_G_FMT:
+    *(struct v4l2_format*)arg = driver.fmt;
+    return 0;
+  case VIDIOC_S_FMT: {
+    struct v4l2_format* fmt = (struct v4l2_format*)arg;
+    fmt->fmt.pix.width -= fmt->fmt.pix.width % driver.widthStep;
+    fmt->fmt.pix.sizeimage = fmt->fmt.pix.width * fmt->fmt.pix.height * 2;
+    driver.fmt = *fmt;
+    return 0;
+  }
+  case VIDIOC_G_SELECTION:
+    if(!driver.selection) break;
+    ((struct v4l2_selection*)arg)->r = driver.crop;
+    return 0;
+  case VIDIOC_S_SELECTION:
+    if(!driver.selection) break;
+    driver.crop = ((struct v4l2_selection*)arg)->r;
+    return 0;
+  case VIDIOC_S_CROP:
+    driver.crop = ((struct v4l2_crop*)arg)->c;
+    return 0;
+  }
+  errno = ENOTTY;
+  return -1;
+}
+
+// only the calls in econ.h go to the fake driver
+#define ioctl fake_ioctl
+#include "econ.h"
+#undef ioctl
+
+static struct v4l2_rect rect(int left, int top, int width, int height) {
+  struct v4l2_rect r;
+  r.left = left;
+  r.top = top;
+  r.width = width;
+  r.height = height;
+  return r;
+}
+
+static bool sameRect(const struct v4l2_rect& a, const struct v4l2_rect& b) {
+  return a.left == b.left && a.top == b.top && a.width == b.width && a.height == b.height;
+}
+
+// a driver with the selection API takes the crop through S_SELECTION
+static void testSelection() {
+  resetDriver(true, 1);
+  econ camera(0, 1600, 1200);
+
+  struct v4l2_rect crop;
+  int width, height;
+  camera.getMode(crop, width, height);
+  CHECK(sameRect(crop, rect(0, 0, 1600, 1200)));
+  CHECK(width == 1600 && height == 1200);
+
+  driver.calls.clear();
+  CHECK(camera.setMode(rect(400, 300, 800, 600), 800, 600) == 0);
+  CHECK(calls(VIDIOC_S_SELECTION) == 1);
+  CHECK(calls(VIDIOC_S_CROP) == 0);
+  CHECK(sameRect(driver.crop, rect(400, 300, 800, 600)));
+
+  camera.getMode(crop, width, height);
+  CHECK(sameRect(crop, rect(400, 300, 800, 600)));
+  CHECK(width == 800 && height == 600);
+}
+
+// a driver without it falls back to S_CROP, and getMode reports the
+// crop asked for since it cannot be read back
+static void testCropFallback() {
+  resetDriver(false, 1);
+  econ camera(0, 1600, 1200);
+
+  driver.calls.clear();
+  CHECK(camera.setMode(rect(200, 100, 1200, 900), 600, 450) == 0);
+  CHECK(calls(VIDIOC_S_SELECTION) == 1);
+  CHECK(calls(VIDIOC_S_CROP) == 1);
+  CHECK(sameRect(driver.crop, rect(200, 100, 1200, 900)));
+
+  struct v4l2_rect crop;
+  int width, height;
+  camera.getMode(crop, width, height);
+  CHECK(sameRect(crop, rect(200, 100, 1200, 900)));
+  CHECK(width == 600 && height == 450);
+}
+
+// getMode gives the frame size the driver settled on, not the one asked for
+static void testDriverRounding() {
+  resetDriver(true, 16);
+  econ camera(0, 1600, 1200);
+
+  CHECK(camera.setMode(rect(0, 0, 1600, 1200), 810, 600) == 0);
+  struct v4l2_rect crop;
+  int width, height;
+  camera.getMode(crop, width, height);
+  CHECK(width == 800 && height == 600);
+}
+
+static CameraConfig calibration(int width, int height, double fx, double fy, double cx, double cy) {
+  CameraConfig config;
+  config.width = width;
+  config.height = height;
+  config.sensorCrop = cv::Rect(0, 0, 1600, 1200);
+  config.cameraMatrix = (cv::Mat_<double>(3,3) << fx, 0., cx, 0., fy, cy, 0., 0., 1.);
+  config.distCoeffs = cv::Mat::zeros(5, 1, CV_64F);
+  return config;
+}
+
+static void checkMatrix(const CameraConfig& config, double fx, double fy, double cx, double cy) {
+  CHECK_NEAR(config.cameraMatrix.at<double>(0,0), fx, 1e-9);
+  CHECK_NEAR(config.cameraMatrix.at<double>(1,1), fy, 1e-9);
+  CHECK_NEAR(config.cameraMatrix.at<double>(0,2), cx, 1e-9);
+  CHECK_NEAR(config.cameraMatrix.at<double>(1,2), cy, 1e-9);
+}
+
+static void testRescale() {
+  CameraConfig full = calibration(1600, 1200, 1000, 1002, 799.5, 599.5);
+
+  // binning halves the focal lengths and keeps the center in the middle
+  CameraConfig binned = rescaleCamera(full, cv::Rect(0, 0, 1600, 1200), 800, 600);
+  checkMatrix(binned, 500, 501, 399.5, 299.5);
+  CHECK(binned.width == 800 && binned.height == 600);
+
+  // a crop keeps the focal lengths and moves the center by its corner
+  CameraConfig cropped = rescaleCamera(full, cv::Rect(400, 300, 800, 600), 800, 600);
+  checkMatrix(cropped, 1000, 1002, 399.5, 299.5);
+
+  // and both together
+  checkMatrix(rescaleCamera(full, cv::Rect(400, 300, 800, 600), 400, 300), 500, 501, 199.5, 149.5);
+
+  // a calibration made on a binned mode scales back up to the full sensor
+  CameraConfig small = calibration(800, 600, 500, 501, 399.5, 299.5);
+  checkMatrix(rescaleCamera(small, cv::Rect(0, 0, 1600, 1200), 1600, 1200), 1000, 1002, 799.5, 599.5);
+
+  // the distortion acts on normalized coordinates and is unchanged
+  CHECK(cv::norm(binned.distCoeffs, full.distCoeffs) == 0);
+}
+
+// the mode the driver reports after a switch is what gets rescaled to
+static void testModeSwitch() {
+  resetDriver(false, 16);
+  econ camera(0, 1600, 1200);
+  CameraConfig full = calibration(1600, 1200, 1000, 1000, 799.5, 599.5);
+
+  CHECK(camera.setMode(rect(320, 240, 960, 720), 490, 360) == 0);
+  struct v4l2_rect crop;
+  int width, height;
+  camera.getMode(crop, width, height);
+  CHECK(width == 480 && height == 360);
+
+  CameraConfig scaled = rescaleCamera(full, cv::Rect(crop.left, crop.top, crop.width, crop.height), width, height);
+  checkMatrix(scaled, 500, 500, (800 - 320)*0.5 - 0.5, (600 - 240)*0.5 - 0.5);
+}
+
+int main() {
+  testSelection();
+  testCropFallback();
+  testDriverRounding();
+  testRescale();
+  testModeSwitch();
+  return checkResult("test_econ");
+}
@@ -0,0 +1,126 @@
+/******************************************
+ * test_gpio.cpp
+ *
+ * Checks that GPIO reads follow the value
+ * file through the fd kept open, using a
+ * directory laid out like /sys/class/gpio.
+ * Its files are regular files, which give
+ * no edges, so fly falls back to reading
+ * the arm switch every tick; the reads are
+ * checked along that path.
+ *
+ * usage: test_gpio
+ ******************************************/
+
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+
+#include "GPIO.h"
+#include "check.h"
+
+static std::string contents(const std::string& file)
+{
+	std::ifstream in(file.c_str());
+	std::stringstream text;
+	text << in.rdbuf();
+	return text.str();
+}
+
+// rewritten in place, as the kernel does, so the open fd sees it
+static void replace(const std::string& file, const std::string& text)
+{
+	std::ofstream out(file.c_str(), std::ios::trunc);
+	out << text;
+}
+
+// a root with gpioNum already exported, its value 0
+static std::string fakeRoot(int gpioNum)
+{
+	char name[] = "/tmp/test_gpioXXXXXX";
+	std::string root = mkdtemp(name) ? name : "";
+	std::string dir = root + "/gpio" + std::to_string(gpioNum);
+	mkdir(dir.c_str(), 0755);
+	replace(root + "/export", "");
+	replace(dir + "/direction", "out\n");
+	replace(dir + "/value", "0\n");
+	return root;
+}
+
+static void removeRoot(const std::string& root, int gpioNum)
+{
+	std::string dir = root + "/gpio" + std::to_string(gpioNum);
+	unlink((dir + "/value").c_str());
+	unlink((dir + "/direction").c_str());
+	unlink((dir + "/edge").c_str());
+	rmdir(dir.c_str());
+	unlink((root + "/export").c_str());
+	rmdir(root.c_str());
+}
+
+// the pin is set up as an input and its value followed through the open fd
+static void testRead(const std::string& root)
+{
+	GPIO pin(10, true, root);
+	CHECK(pin.isOpen());
+	CHECK(contents(root + "/gpio10/direction") == "in\n");
+	CHECK(pin.read() == '0');
+
+	replace(root + "/gpio10/value", "1\n");
+	CHECK(pin.read() == '1');
+	CHECK(pin.read() == '1');
+
+	replace(root + "/gpio10/value", "0\n");
+	CHECK(pin.read() == '0');
+}
+
+// as fly sets up the arm switch: the edge file takes the setting, but a
+// regular file cannot be waited on, so epoll refuses it and the value
+// is read every tick instead
+static void testNoEdges(const std::string& root)
+{
+	GPIO pin(10, true, root);
+	CHECK(pin.setEdge("both"));
+	CHECK(contents(root + "/gpio10/edge") == "both\n");
+
+	int epfd = epoll_create1(EPOLL_CLOEXEC);
+	struct epoll_event ev;
+	ev.events = EPOLLPRI;
+	ev.data.fd = pin.fd();
+	bool armEvents = epoll_ctl(epfd, EPOLL_CTL_ADD, pin.fd(), &ev) == 0;
+	close(epfd);
+	CHECK(!armEvents);
+	CHECK(!pin.waitForEdge(0));
+
+	const char* ticks = "0110100";
+	for (const char* tick = ticks; *tick; tick++)
+	{
+		replace(root + "/gpio10/value", std::string(1, *tick) + "\n");
+		CHECK(pin.read() == *tick);
+	}
+}
+
+// a pin that cannot be opened reads as 0
+static void testMissing(const std::string& root)
+{
+	GPIO pin(11, true, root);
+	CHECK(!pin.isOpen());
+	CHECK(pin.read() == 0);
+	CHECK(contents(root + "/export") == "11");
+}
+
+int main()
+{
+	std::string root = fakeRoot(10);
+
+	testRead(root);
+	testNoEdges(root);
+	testMissing(root);
+
+	removeRoot(root, 10);
+	return checkResult("test_gpio");
+}
@@ -0,0 +1,135 @@
+/******************************************
+ * test_pwm_output.cpp
+ *
+ * Checks that PwmOutput only writes a value
+ * when it changed, and writes it again after
+ * a write that failed. The channels are
+ * regular files, as when trying fly without
+ * the hardware.
+ *
+ * usage: test_pwm_output
+ ******************************************/
+
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+
+#include "pwmOutput.h"
+#include "check.h"
+
+static std::string contents(const std::string& file)
+{
+    std::ifstream in(file.c_str());
+    std::stringstream text;
+    text << in.rdbuf();
+    return text.str();
+}
+
+static void replace(const std::string& file, const std::string& text)
+{
+    std::ofstream out(file.c_str(), std::ios::trunc);
+    out << text;
+}
+
+static std::string tempFile()
+{
+    char name[] = "/tmp/test_pwm_outputXXXXXX";
+    int fd = mkstemp(name);
+    if (fd >= 0) close(fd);
+    return name;
+}
+
+// a value is written once, however many ticks it is set for
+static void testUnchanged(PwmOutput& pwm, const std::string& file)
+{
+    pwm.set(PWM_THROTTLE, 1500);
+    CHECK(pwm.write() == 1);
+    CHECK(pwm.writes() == 1);
+    CHECK(contents(file) == "1500");
+
+    // a second write of the same value would put the file back
+    replace(file, "untouched");
+    pwm.set(PWM_THROTTLE, 1500);
+    CHECK(pwm.write() == 0);
+    CHECK(pwm.writes() == 1);
+    CHECK(contents(file) == "untouched");
+}
+
+// a changed value is written, with no digits of the last one left over
+static void testChanged(PwmOutput& pwm, const std::string& file)
+{
+    uint64_t before = pwm.writes();
+    pwm.set(PWM_THROTTLE, 900);
+    CHECK(pwm.write() == 1);
+    CHECK(pwm.writes() == before + 1);
+    CHECK(contents(file) == "900");
+}
+
+// a write cut short is not counted as written, so the next write sends
+// the value again without it being set again. Failures are counted
+// every tick they happen
+static void testRewriteAfterError(PwmOutput& pwm, const std::string& file)
+{
+    uint64_t before = pwm.writes();
+    uint64_t failed = pwm.failures();
+
+    // files may not grow past 3 bytes, so "1500" is cut short. The
+    // limit would cut the expected failure message short too when
+    // stderr is a file, so it goes to /dev/null meanwhile
+    struct rlimit limit, small;
+    getrlimit(RLIMIT_FSIZE, &limit);
+    small = limit;
+    small.rlim_cur = 3;
+    signal(SIGXFSZ, SIG_IGN);
+    int err = dup(STDERR_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDERR_FILENO);
+    close(null);
+    bool limited = setrlimit(RLIMIT_FSIZE, &small) == 0;
+
+    pwm.set(PWM_THROTTLE, 1500);
+    int sent = pwm.write();
+    sent += pwm.write();
+
+    setrlimit(RLIMIT_FSIZE, &limit);
+    signal(SIGXFSZ, SIG_DFL);
+    dup2(err, STDERR_FILENO);
+    close(err);
+
+    CHECK(limited);
+    CHECK(sent == 0);
+    CHECK(pwm.writes() == before);
+    CHECK(pwm.failures() == failed + 2);
+
+    CHECK(pwm.write() == 1);
+    CHECK(pwm.writes() == before + 1);
+    CHECK(contents(file) == "1500");
+    CHECK(pwm.failures() == failed + 2);
+
+    CHECK(pwm.write() == 0);
+}
+
+int main()
+{
+    std::string file = tempFile();
+    std::string devices[PWM_CHANNELS];
+    devices[PWM_THROTTLE] = file;
+
+    {
+        PwmOutput pwm(devices);
+        CHECK(pwm.isOpen(PWM_THROTTLE));
+        CHECK(!pwm.isOpen(PWM_ROLL));
+
+        testUnchanged(pwm, file);
+        testChanged(pwm, file);
+        testRewriteAfterError(pwm, file);
+    }
+
+    unlink(file.c_str());
+    return checkResult("test_pwm_output");
+}